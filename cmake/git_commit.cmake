@@ -0,0 +1,23 @@
+# Writes OUTPUT, a header defining GIT_COMMIT as the commit of SOURCE_DIR (git describe --always --dirty).
+# Run at every build by the git_commit target; the header is only rewritten when the commit changed, so that an
+# unchanged tree does not recompile.
+#   cmake -DGIT_EXECUTABLE=<git> -DSOURCE_DIR=<dir> -DOUTPUT=<header> -P git_commit.cmake
+set(GIT_COMMIT "")
+if(GIT_EXECUTABLE)
+    execute_process(COMMAND ${GIT_EXECUTABLE} describe --always --dirty
+                    WORKING_DIRECTORY ${SOURCE_DIR}
+                    OUTPUT_VARIABLE GIT_COMMIT OUTPUT_STRIP_TRAILING_WHITESPACE ERROR_QUIET)
+endif()
+
+if(GIT_COMMIT)
+    set(CONTENT "#define GIT_COMMIT \"${GIT_COMMIT}\"\n")
+else()
+    set(CONTENT "/* Not built from a git checkout */\n")
+endif()
+
+if(EXISTS ${OUTPUT})
+    file(READ ${OUTPUT} OLD_CONTENT)
+endif()
+if(NOT CONTENT STREQUAL OLD_CONTENT)
+    file(WRITE ${OUTPUT} "${CONTENT}")
+endif()
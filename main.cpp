@@ -15,297 +15,5913 @@
 
 #include <iostream>
 #include <cmath>
+#include <cstdlib>
 #include <filesystem>
+#include <fstream>
+#include <algorithm>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <cstdint>
+#include <atomic>
+#include <limits>
+#include <unordered_map>
+#include <numeric>
+#include <random>
+#include <ctime>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+#ifdef HAVE_LIBPNG
+#include <png.h>
+#endif
+#ifdef HAVE_GIT_COMMIT_H
+#include "git_commit.h"
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/* Hot pixel loops are compiled for AVX-512, AVX2 and the baseline, and the loader picks the best version for the CPU.
+   Only loops that vectorize (check with -fopt-info-vec) are worth the clones; sqrt needs -fno-math-errno for it. */
+#if defined(__x86_64__) && defined(__GNUC__) && defined(__linux__)
+#define HOT_KERNEL __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define HOT_KERNEL
+#endif
 #include <opencv4/opencv2/opencv.hpp>
+#include "xlsxwriter.h"
 
 /* 
 * Creating a new variable type to get NCC results. (LocAndConf --> Location & Confidence)
 * match_loc: saves location of found template
 * confidence: cross-correlation value of the found template
-* shift_row, shift_col: saving pixel shift with respect to the center of frame
+* shift_row, shift_col: saving pixel shift with respect to where the RoI was taken from in frame_0 (the reference
+*   get_results() measures it from the center of the frame, which is the same for the default, centred RoI)
+* psr: peak-to-sidelobe ratio, (peak - sidelobe mean) / sidelobe standard deviation (NaN if there is no sidelobe)
+* peak_ratio: highest value outside the peak divided by the peak, close to 1 when another spot matches as well
 */
 struct LocAndConf
 {
     cv::Point match_loc;
     double confidence;
     int shift_row, shift_col;
+    double psr = std::numeric_limits<double>::quiet_NaN();
+    double peak_ratio = std::numeric_limits<double>::quiet_NaN();
 };
 
-/* 
-* This function goes recursively through the directory containing images and uses other functions to calculate and save NCC results.
-* func: recursive_folders()
-* param: relative path with respect to build folder
-* return: 0 or 1
+/*
+* One scan over an NCC result matrix that finds its maximum and how clearly it stands out (see LocAndConf).
+* The positions are grouped into blocks of block x block, each keeping its maximum, sum and sum of squares. Once the
+* scan is done, the blocks within 'exclusion' positions of the maximum make up the peak and all other blocks the
+* sidelobe (the exclusion zone rounded out to whole blocks), so neither the PSR nor the secondary peak needs another
+* pass over the matrix.
 */
-int recursive_folders(const std::string &root_path);
+class PeakScan
+{
+public:
+    static constexpr int block = 8;
+    static constexpr int exclusion = 5;
 
-/* 
-* This function calculates MIG (Mean Intensity Gradient) for a single frame and return that value.
+    struct Block
+    {
+        double max, sum, sq_sum;
+    };
 
-* func: mig_frame()
-* param: reference to an OpenCV matrix object
-* return: MIG value of type double for the given frame
+    /* Starts the scan of a result matrix of cols x rows positions, reusing the given block buffer */
+    PeakScan(int cols, int rows, std::vector<Block> &blocks);
+
+    /* Adds the value at position (x, y). Keeps the first maximum in row order like cv::minMaxLoc(). */
+    void add(int x, int y, double value)
+    {
+        Block &b = blocks[static_cast<size_t>(y / block) * blocks_x + x / block];
+        b.max = std::max(b.max, value);
+        b.sum += value;
+        b.sq_sum += value * value;
+        if (value > max_value)
+        {
+            max_value = value;
+            max_loc = cv::Point(x, y);
+        }
+    }
+
+    /* Fills match_loc, confidence, psr and peak_ratio of 'a' (shift_row and shift_col are left to the caller) */
+    void finish(LocAndConf &a) const;
+
+private:
+    std::vector<Block> &blocks;
+    int cols, rows;
+    int blocks_x, blocks_y;
+    double max_value = -std::numeric_limits<double>::infinity();
+    cv::Point max_loc;
+};
+
+/*
+* Hardware counter values, or their difference over a stage (--perf-counters, see PerfCounters).
+* llc_misses: last level cache misses
 */
-double mig_frame(const cv::Mat &frame);
+struct PerfSample
+{
+    uint64_t cycles = 0, instructions = 0, llc_misses = 0, branch_misses = 0;
+
+    PerfSample operator-(const PerfSample &start) const
+    {
+        return {cycles - start.cycles, instructions - start.instructions, llc_misses - start.llc_misses, branch_misses - start.branch_misses};
+    }
+    PerfSample &operator+=(const PerfSample &other)
+    {
+        cycles += other.cycles;
+        instructions += other.instructions;
+        llc_misses += other.llc_misses;
+        branch_misses += other.branch_misses;
+        return *this;
+    }
+};
 
 /*
-* This function creates (recursive) folders.
+* Hardware counters of the stages of a frame.
+* decode: decode_frame()
+* mig: mig_frame(), including the frame cache lookup
+* ncc: get_results() or, in sweep mode, the spectrum of the frame and match_spectral(), plus the consistency check
+*/
+struct StagePerf
+{
+    PerfSample decode, mig, ncc;
 
-* func: create_folders()
-* param: path relative to build folder
-* return: void
+    StagePerf &operator+=(const StagePerf &other)
+    {
+        decode += other.decode;
+        mig += other.mig;
+        ncc += other.ncc;
+        return *this;
+    }
+};
+
+/*
+* Parts of the program that memory is accounted to (--memory-stats). An allocation is charged to the stage of the
+* allocating thread (see MemoryScope) and released from that stage, whichever thread frees it.
+* Decode: frame files and decoded frames
+* Mig: MIG temporaries and the frame cache lookup
+* Ncc: NCC result matrices, spectra and the consistency check
+* Writer: rows on their way to the writer, and the writer itself
+* Queues: scheduler queues and read-ahead jobs
+* Other: everything else (setup, RoIs, reports)
 */
-void create_folders(const std::string &path);
+enum class MemoryStage : uint8_t
+{
+    Decode,
+    Mig,
+    Ncc,
+    Writer,
+    Queues,
+    Other,
+    Count
+};
+
+/* Memory statistics of one stage, updated with relaxed atomics by every thread */
+struct MemoryCounters
+{
+    std::atomic<uint64_t> allocations{0}, allocated_bytes{0};
+    std::atomic<int64_t> live_buffers{0}, live_bytes{0}, peak_live_bytes{0};
+};
+
+/* Charges the allocations of the calling thread to a stage while it exists */
+class MemoryScope
+{
+public:
+    explicit MemoryScope(MemoryStage stage);
+    ~MemoryScope();
+    MemoryScope(const MemoryScope &) = delete;
+    MemoryScope &operator=(const MemoryScope &) = delete;
+
+private:
+    MemoryStage previous;
+};
+
+/* Allocator of cv::Mat buffers that counts them like operator new does, on top of OpenCV's standard allocator */
+class CountingMatAllocator : public cv::MatAllocator
+{
+public:
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step, cv::AccessFlag flags, cv::UMatUsageFlags usage) const override;
+    bool allocate(cv::UMatData *data, cv::AccessFlag access, cv::UMatUsageFlags usage) const override;
+    void deallocate(cv::UMatData *data) const override;
+};
 
 /*
-* This function gets Region of Interest (RoI) from a frame which would be used as template to perform template matching.
+* Values computed by a worker for one frame and one RoI configuration, i.e. one row of Results.csv.
+* index: frame number
+* ncc: NCC results of the frame against the RoI of frame_0
+* mig: MIG value of the frame
+* cache_key: key of the frame in the frame cache (0 if the cache is off or the frame is empty)
+* cached: true if mig was taken from the frame cache
+* mismatch: 1 if the forward-backward consistency check failed, 0 if it passed, NaN if it was not run
+* skipped: true if the frame barely changed and the values of the last processed frame were reused (--skip-static)
+* perf: hardware counters of the row (--perf-counters). Decoding and MIG are counted on the first row of a frame only.
+* dist_x, dist_y: pixel shift converted to mm with the transformation matrix
+* error_x, error_y, error_x_pct, error_y_pct: difference to the commanded movement in mm and in % of it, NaN when
+*                                            there is no ground truth (or the commanded movement is 0 for %)
+*/
+struct FrameRow
+{
+    size_t index;
+    LocAndConf ncc;
+    double mig;
+    uint64_t cache_key;
+    bool cached;
+    double mismatch;
+    bool skipped;
+    StagePerf perf;
+    double dist_x, dist_y;
+    double error_x, error_y, error_x_pct, error_y_pct;
+};
 
-* func: get_roi()
-* param: 
-    - reference to OpenCV frame/matrix object
-    - width of RoI
-    - height of RoI
-    - Coordinates of top left corner of RoI
-* return: OpenCV frame/matrix object 
+/*
+* A value of a csv row, written straight into the stream, as an empty cell when it is NaN (not available).
+* value: value of the cell
 */
-cv::Mat get_roi(cv::Mat &frame, const int &width, const int &height, const int &topLeft_x, const int &topLeft_y);
+struct CsvCell
+{
+    double value;
+};
+
+std::ostream &operator<<(std::ostream &stream, const CsvCell &cell);
 
 /*
-* This function performs NCC template matching and returns the results from the match.
+* Commanded stage movement of a Move_N folder, read from its movement.txt:
+*     # commanded movement in mm
+*     x 0.5
+*     y 0
+*     per_frame 0
+* x, y: expected displacement of every frame with respect to frame_0 in mm
+* per_frame: if 1, x and y are the movement between two frames instead, i.e. frame N is expected at N * (x, y)
+* valid: false if the folder has no (readable) movement.txt
+*/
+struct MovementTruth
+{
+    double x = 0, y = 0;
+    bool per_frame = false;
+    bool valid = false;
+};
 
-* func: get_results
-* param: 
-    - reference to OpenCV frame object
-    - reference of OpenCV RoI object
-    - width and height of frame
-    - width and height of RoI
-* return: struct type LocAndConf
+/*
+* Results of one benchmark run (--bench), as stored in its JSON file.
+* commit: git commit the binary was built from ("unknown" if it was built outside a git checkout)
+* cpu: CPU model from /proc/cpuinfo
+* date: local time of the run
+* samples: frames per second of every repetition, per benchmark
 */
-LocAndConf get_results(cv::Mat &frame, cv::Mat &roi, const int &frameWidth, const int &frameHeight, const int &width, const int &height);
+struct BenchmarkRun
+{
+    std::string commit, cpu, date;
+    std::vector<std::pair<std::string, std::vector<double>>> samples;
+};
 
-/* Main */
-int main()
+/*
+* Online constant velocity Kalman filter of the pixel shift, one independent filter per axis, updated once per frame.
+* Each axis has position p and velocity v (pixels, pixels per frame) with covariance [p00 p01; p01 p11]. The process
+* noise is a white acceleration of variance q, measurements have variance r.
+*/
+struct ShiftFilter
 {
-    // Give the absolute path of folder that contains all the experiments and the images
-    std::string images_dir = "../laser_decorrelation_images";
-    recursive_folders(images_dir);
+    struct Axis
+    {
+        double p = 0, v = 0;
+        double p00 = 0, p01 = 0, p11 = 0;
 
-    return EXIT_SUCCESS;
-}
+        /* Advances one frame without a measurement */
+        void predict(double q);
 
-int recursive_folders(const std::string &root_path)
+        /* Takes the measurement z of the current frame (after predict()) and returns the innovation */
+        double correct(double z, double r);
+    };
+
+    Axis x, y;
+    bool started = false;
+
+    /* Advances one frame and takes the measured shift, returns the innovation magnitude (NaN for the first frame) */
+    double update(double shift_x, double shift_y, double q, double r);
+
+    /* Advances one frame without a measurement, e.g. for a frame that could not be matched */
+    void coast(double q);
+};
+
+/*
+* Running mean, variance, minimum and maximum of one quantity (Welford's algorithm), updated one value at a time so
+* that statistics never need a second pass over the values.
+*/
+struct RunningStats
 {
-    /* Transformation Matrix Parameters */
-    const double Txx = -256.75;
-    const double Txy = 2.5;
-    const double Tyx = 3.5;
-    const double Tyy = 260.5;
+    size_t count = 0;
+    double mean = 0, m2 = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
 
-    /* Constants for NCC */
-    const int roi_w = 128, roi_h = 128, topLeft_x = 300, topLeft_y = 208, frameWidth = 728, frameHeight = 544;
-    
-    /* Checking whether 'image' directory is present. */
-    if (!std::filesystem::exists(root_path))
-    {
-        std::cout << "The 'images' directory does not exist inside this project's directory.\n"
-                  << "Please copy it from the project: 'img_acq_testing'.\n"
-                  << std::endl;
-        return EXIT_FAILURE;
-    } else
-    {
-        std::cout << "/// Directory 'images' found." << std::endl;
-    }
+    void add(double value);
+    double stddev() const { return count > 1 ? std::sqrt(m2 / (count - 1)) : 0.0; }
+};
 
-    /* Iterating through the 'images' folder */
-    for (const auto &cam_param_entry: std::filesystem::directory_iterator(root_path))
-    {
-        if (cam_param_entry.is_directory())
-        {
-            std::string cam_param_dir = cam_param_entry.path();
-            std::cout << "/// Inside Camera Param Directory     :       " << cam_param_dir << std::endl;
+/*
+* Statistics of the Results.csv columns of one experiment and RoI configuration, updated by the writer as rows are
+* written. Frames that were not matched (confidence 0: unreadable, or the search window smaller than the RoI) only
+* count in 'frames' and 'unmatched', unreadable ones have no MIG either.
+*/
+struct ExperimentSummary
+{
+    RunningStats shift_x, shift_y, confidence, dist_x, dist_y, mig;
+    RunningStats error_x, error_y;
+    RunningStats psr, peak_ratio;
+    size_t frames = 0;
+    size_t unmatched = 0;
+    size_t mismatches = 0;
+    size_t skipped = 0;
+};
 
-            for (const auto &movement_entry: std::filesystem::directory_iterator(cam_param_dir))
-            {
-                if (movement_entry.is_directory())
-                {
-                    std::string movement_dir = movement_entry.path();
-                    std::cout << "/// Inside Movement Directory         :       " << movement_dir << std::endl;
+/*
+* Position and size of a RoI in frame_0, in pixels. By default the single RoI given by the NCC constants, several of
+* them with --sweep.
+*/
+struct RoiConfig
+{
+    int x, y, w, h;
 
-                    for (const auto &exp_entry: std::filesystem::directory_iterator(movement_dir))
-                    {
-                        if (exp_entry.is_directory())
-                        {
-                            std::string exp_dir = exp_entry.path();
-                            std::cout << "/// Inside Experiment Directory       :       " << exp_dir << std::endl;
+    /* Name of the configuration in file names and reports, e.g. "300_208_128x128" */
+    std::string label() const;
 
-                            /* Creating folders at this path */
-                            create_folders("../laser_decorrelation_results/" + cam_param_entry.path().filename().string() + "/" + movement_entry.path().filename().string() + "/" + exp_entry.path().filename().string());
+    /* Top left corner of the RoI in frame_0, where its shifts are measured from */
+    cv::Point tl() const;
+};
 
-                            /* Creating folders to save NCC images */
-                            create_folders("../laser_decorrelation_images_ncc/" + cam_param_entry.path().filename().string() + "/" + movement_entry.path().filename().string() + "/" + exp_entry.path().filename().string());
+/*
+* Spectrum of a RoI for the spectral NCC of the sweep mode and the consistency check (see match_spectral()).
+* spectrum: DFT of the RoI as float, zero padded to the DFT size of the frames (CCS packed)
+* norm: square root of the sum of the squared RoI pixels
+*/
+struct TemplateSpectrum
+{
+    cv::Mat spectrum;
+    double norm = 0;
+};
 
-                            /* Creating a csv file */
-                            std::string csv_path = "../laser_decorrelation_results/" + cam_param_entry.path().filename().string() + "/" + movement_entry.path().filename().string() + "/" + exp_entry.path().filename().string() + "/" + "Results.csv";
-                            std::ofstream csv_file(csv_path);
-                            if (!csv_file.is_open())
-                            {
-                                std::cerr << "Error opening the .csv file!!!" <<std::endl;
-                                return EXIT_FAILURE;
-                            }
-                            
-                            /* Adding first row to the .csv file */
-                            csv_file << "Pixel Shift X (Columns),Pixel Shift Y (Rows),Confidence (%),Dist. X (mm),Dist. Y (mm),Error X (mm),Error Y (mm),Error X (%),Error Y (%),MIG" << std::endl;
+/*
+* What the spectral NCC needs from the frame a RoI is searched in (see frame_spectrum()).
+* size: size of the frame
+* padded: frame as float, zero padded to the DFT size
+* spectrum: DFT of 'padded' (CCS packed)
+* sum, sq_sum: integral images of the pixels and the squared pixels of the frame
+*/
+struct FrameSpectrum
+{
+    cv::Size size;
+    cv::Mat1f padded;
+    cv::Mat spectrum, sum, sq_sum;
+};
 
-                            /* Declaring an empty string vector to store frame names */
-                            std::vector<std::string> file_names;
+/*
+* Read-only memory mapping of a packed frame container (frames.pack) of one experiment.
+* - Layout: 8 byte magic "MIGPACK1", uint32 frame count, uint32 reserved, then per frame a uint64 offset and uint64 size
+*   (little endian, offsets from the start of the file), followed by the encoded frames.
+* - The mapping is advised MADV_SEQUENTIAL. Readers announce the frames they are about to decode with will_need() and
+*   hand back decoded frames with release(), which drops their pages from the mapping and from the page cache. Datasets
+*   larger than RAM therefore stream through a small window of memory instead of evicting other workloads.
+* - Frames are shared between workers, so only pages lying completely inside a frame are ever dropped.
+* - open_raw() maps a raw sensor dump instead: no header, just frames of 'frame_bytes' bytes back to back.
+*/
+class PackedFrameFile
+{
+public:
+    ~PackedFrameFile();
 
-                            /* Storing filenames inside the vector */
-                            for (const auto &img_entry:std::filesystem::directory_iterator(exp_dir))
-                            {
-                                // std::string img_path = img_entry.path();
-                                file_names.push_back(img_entry.path().filename().string());
-                            }
+    /* Maps the container, returns false if it is missing or malformed */
+    bool open(const std::string &path);
 
-                            /* Sorting filenames */
-                            std::sort(file_names.begin(), file_names.end(), [](const std::string &a, const std::string &b)
-                            {
-                                std::string num_a = a.substr(a.find_first_of("0123456789"));
-                                std::string num_b = b.substr(b.find_first_of("0123456789"));
-                                int int_a = std::stoi(num_a);
-                                int int_b = std::stoi(num_b);
-                                return int_a < int_b;
-                            });
+    /* Maps a raw dump of equally sized frames, returns false if it is missing or not a multiple of 'frame_bytes' */
+    bool open_raw(const std::string &path, size_t frame_bytes);
 
+    size_t frame_count() const { return offsets.size(); }
+    const uchar *frame_data(size_t frame) const { return base + offsets[frame]; }
+    size_t frame_size(size_t frame) const { return sizes[frame]; }
 
-                            /* Getting ROI for the experiment folder */
-                            std::string frame_0_path = exp_entry.path().string() + "/frame_0.png";
-                            cv::Mat frame_0 = cv::imread(frame_0_path, cv::IMREAD_GRAYSCALE);
-                            cv::Mat roi = get_roi(frame_0, roi_w, roi_h, topLeft_x, topLeft_y);
+    /* MADV_WILLNEED for frames [begin, end) */
+    void will_need(size_t begin, size_t end) const;
 
-                            /***** MIG and NCC Start *****/
+    /* MADV_DONTNEED + POSIX_FADV_DONTNEED for a frame that is no longer needed */
+    void release(size_t frame) const;
 
-                            for (const auto &file_name: file_names)
-                            {
-                                std::string img_path = exp_entry.path().string() + "/" + file_name;
-                                std::cout << "/// Reading image                     :       " << img_path << std::endl;
-                                // Reading the image 
-                                cv::Mat img = cv::imread(img_path, cv::IMREAD_GRAYSCALE);
-
-                                LocAndConf ncc_results = get_results(img, roi, frameWidth, frameHeight, roi_w, roi_h);
-
-                                // Comment the following for calibration
-                                double shift_col_mm = ((ncc_results.shift_col * Tyy) - (ncc_results.shift_row * Txy)) / ((Txx * Tyy) - (Txy * Tyx));
-                                double shift_row_mm = ((ncc_results.shift_row * Txx) - (ncc_results.shift_col * Tyx)) / ((Txx * Tyy) - (Txy * Tyx));
-
-                                // // Uncomment following during calibration
-                                // csv_file << ncc_results.shift_col << ","
-                                //          << ncc_results.shift_row << ","
-                                //          << ncc_results.confidence << ","
-                                //          << ",,,,,,"
-                                //          << mig_frame(img)
-                                //          << std::endl;
-
-                                // Uncomment the following when trying to save ncc images
-                                // cv::rectangle(img, ncc_results.match_loc, cv::Point(ncc_results.match_loc.x + roi_w, ncc_results.match_loc.y + roi_h), cv::Scalar(0), 3);
-
-                                // cv::putText(img, "Confidence: " + std::to_string(static_cast<int>(std::round(ncc_results.confidence))) + "%", cv::Point(10, 40), cv::FONT_HERSHEY_SIMPLEX, 1.5, cv::Scalar(0), 3);
-
-                                // cv::imwrite("../laser_decorrelation_images_ncc/" + cam_param_entry.path().filename().string() + "/" + movement_entry.path().filename().string() + "/" + exp_entry.path().filename().string() + "/" + file_name, img);
-
-                                // Uncomment following during testing
-                                csv_file << ncc_results.shift_col << ","
-                                         << ncc_results.shift_row << ","
-                                         << ncc_results.confidence << ","
-                                         << shift_col_mm << ","
-                                         << shift_row_mm << ","
-                                         << ",,,,"
-                                         << mig_frame(img)
-                                         << std::endl;
-                            }
+    /* Unmaps the file and closes its descriptor, frame_count() stays valid */
+    void close();
 
-                            /***** MIG and NCC End *****/
+    static constexpr const char *magic = "MIGPACK1";
 
-                            csv_file.close();
-                        }
-                    }
-                }
-            }
-        }
-    }
+private:
+    bool map(const std::string &path);
 
-    return EXIT_SUCCESS;
-}
+    int fd = -1;
+    uchar *base = nullptr;
+    size_t mapped_size = 0;
+    std::vector<uint64_t> offsets, sizes;
+};
 
-void create_folders(const std::string &path)
+struct FrameScratch;
+
+/*
+* Layout of the bytes of a frame.
+* Encoded: PNG (or any other format cv::imdecode understands)
+* Mono8: raw sensor dump, one byte per pixel
+* Mono12p: raw sensor dump, 12 bit pixels packed two into three bytes (GenICam Mono12p):
+*          p0 = b0 | (b1 & 0x0F) << 8, p1 = (b1 >> 4) | b2 << 4
+*/
+enum class PixelFormat
 {
-    try
-    {
-        if (std::filesystem::exists(path))
-        {
-            std::cout << "\n////////////////////////////////////////////////////////////////////////////////////////\n" 
-                      << "/// Folder already exists at path     :       " << path 
-                      << "\n////////////////////////////////////////////////////////////////////////////////////////\n" 
-                      << std::endl;
-        } else
-        {
-            std::filesystem::create_directories(path);
-            std::cout << "\n////////////////////////////////////////////////////////////////////////////////////////\n"
-                      << "/// Folder created at path            :       " << path 
-                      << "\n////////////////////////////////////////////////////////////////////////////////////////\n"
-                      << std::endl;
-        }
-    } catch (const std::filesystem::filesystem_error &e)
-    {
-        std::cerr << "/// Error creating folder                 :       " << e.what() << std::endl; 
-    }
-}
+    Encoded,
+    Mono8,
+    Mono12p
+};
 
-double mig_frame(const cv::Mat &frame)
+/*
+* One frame handed out by a FrameSource. Either 'data'/'size' point to the bytes of the frame in 'format', or 'pixels'
+* holds the frame itself. Both only stay valid until the next frame is requested.
+* index: frame number within the experiment
+* ok: false if the frame could not be read
+*/
+struct FrameView
 {
-    if (frame.empty())
-    {
-        std::cout << "Image is empty or corrupted. Please check file." << std::endl;
-        return EXIT_FAILURE;
-    }
-    cv::Mat1f dx, dy, mag; // Declare matrices to store float values
-    cv::Sobel(frame, dx, CV_32F, 1, 0, 3);
-    cv::Sobel(frame, dy, CV_32F ,0, 1, 3);
-    cv::magnitude(dx, dy, mag); // Source -> Destination
-    cv::Scalar total = cv::sum(mag);
-    double mig = total[0] / (frame.rows * frame.cols);
-    return mig;
-}
+    size_t index = 0;
+    bool ok = false;
+    PixelFormat format = PixelFormat::Encoded;
+    const uchar *data = nullptr;
+    size_t size = 0;
+    cv::Mat pixels;
 
-cv::Mat get_roi(cv::Mat &frame, const int &width, const int &height, const int &topLeft_x, const int &topLeft_y)
+    /* Significant bits of the pixels of 'frame' decoded from this view: 12 for Mono12p, all bits of its depth otherwise */
+    int significant_bits(const cv::Mat &frame) const;
+};
+
+/* Outcome of FrameSource::read() */
+enum class FrameStatus
 {
-    cv::Mat copy_frame;
-    frame.copyTo(copy_frame);
-    cv::Rect roiRect(topLeft_x, topLeft_y, width, height);
-    cv::Mat roi = copy_frame(roiRect);
-    return roi;
-}
+    Ok,
+    Unreadable,
+    End
+};
 
-LocAndConf get_results(cv::Mat &frame, cv::Mat &roi, const int &frameWidth, const int &frameHeight, const int &width, const int &height)
+class FrameRange;
+
+/*
+* Where the frames of one experiment come from. The processing loop only iterates over range(), so it does not care
+* whether frames are PNG files, a container, a video or a shared memory ring. Each source brings its own zero-copy and
+* read-ahead strategy.
+* - Sources with random_access() can be read by several workers at once, each reading its own range of frames. The
+*   experiment is then split into chunks.
+* - Streams (video, shared memory) are read by one worker from frame 0 until read() returns FrameStatus::End.
+*/
+class FrameSource
 {
-    LocAndConf a; // variable of the type struct
-    cv::Mat copy_frame;
-    cv::Mat copy_roi;
-    cv::Point minLoc;
-    cv::Point maxLoc;
-    cv::Mat result;
-    double minVal, maxVal;
-    frame.copyTo(copy_frame);
-    roi.copyTo(copy_roi);
-    cv::matchTemplate(copy_frame, copy_roi, result, cv::TM_CCORR_NORMED, cv::Mat());
-    cv::minMaxLoc(result, &minVal, &maxVal, &minLoc, &maxLoc, cv::Mat());
-    a.match_loc = maxLoc;
-    a.confidence = maxVal * 100;
+public:
+    virtual ~FrameSource() = default;
 
-    // -ve value -> template moving up, +ve value -> template moving down
-    a.shift_row = (maxLoc.y + ((height)/2)) - ((frameHeight)/2);
+    /* Short description for the log */
+    virtual std::string describe() const = 0;
 
-    // -ve value -> template moving left, +ve value -> template moving right
-    a.shift_col = (maxLoc.x + ((width)/2)) - ((frameWidth)/2);
+    /* Name of a frame for the log (path of the file where there is one) */
+    virtual std::string frame_name(size_t index) const;
+
+    /* Number of frames, for streams only an estimate (0 if unknown) */
+    virtual size_t frame_count() const = 0;
+
+    virtual bool random_access() const { return true; }
+
+    /* Decoded copy of frame 0, used to take the RoI before any worker starts */
+    virtual cv::Mat first_frame() = 0;
+
+    /* Called by a worker before it reads every step-th frame of [begin, end) in order */
+    virtual void begin_range(size_t begin, size_t end, size_t step, FrameScratch &scratch);
+
+    /* Makes frame 'index' available in 'view', buffers of the worker may be used for it */
+    virtual FrameStatus read(size_t index, FrameScratch &scratch, FrameView &view) = 0;
+
+    /* Called once the worker is done with frame 'index' */
+    virtual void release(size_t index);
+
+    /* Called after the last frame was written, releases descriptors and mappings. No frame is read afterwards. */
+    virtual void close() {}
+
+    /* Every step-th frame of [begin, end) as an iterable range yielding FrameView, streams only with step 1 */
+    FrameRange range(size_t begin, size_t end, size_t step, FrameScratch &scratch);
+};
+
+/*
+* Frames begin, begin + step, ... below end of a FrameSource, read on demand by a single worker:
+*   for (const FrameView &view: source.range(begin, end, step, scratch)) { ... }
+* Advancing the iterator releases the previous frame and reads the next one. Skipped frames are never read.
+*/
+class FrameRange
+{
+public:
+    FrameRange(FrameSource &source, size_t begin, size_t end, size_t step, FrameScratch &scratch);
+
+    class iterator
+    {
+    public:
+        explicit iterator(FrameRange *range) : range(range) {}
+        const FrameView &operator*() const { return range->view; }
+        iterator &operator++() { range->advance(); return *this; }
+        bool operator!=(const iterator &) const { return range != nullptr && !range->done; }
+
+    private:
+        FrameRange *range;
+    };
+
+    iterator begin() { return iterator(this); }
+    iterator end() { return iterator(nullptr); }
+
+private:
+    void read(size_t index);
+    void advance();
+
+    FrameSource &source;
+    FrameScratch &scratch;
+    size_t end_index;
+    size_t step;
+    FrameView view;
+    bool done = false;
+};
+
+/*
+* frame_N.png (or raw frame_N.raw) files of an experiment folder, read ahead by the worker's FramePrefetcher.
+* The layout of a .raw file follows from its size: frameWidth * frameHeight bytes is Mono8, 1.5 times that is Mono12p.
+*/
+class FileTreeSource : public FrameSource
+{
+public:
+    FileTreeSource(const std::string &exp_dir, const std::vector<std::string> &file_names);
+
+    std::string describe() const override { return "frame files"; }
+    std::string frame_name(size_t index) const override { return paths[index]; }
+    size_t frame_count() const override { return paths.size(); }
+    cv::Mat first_frame() override;
+    void begin_range(size_t begin, size_t end, size_t step, FrameScratch &scratch) override;
+    FrameStatus read(size_t index, FrameScratch &scratch, FrameView &view) override;
+
+private:
+    std::vector<std::string> paths;
+};
+
+/*
+* frames.pack of an experiment folder, decoded straight from the memory mapping (see PackedFrameFile).
+* Raw sensor dumps (frames.mono8, frames.mono12p) are mapped the same way, with 'format' telling their pixel layout.
+*/
+class PackedFrameSource : public FrameSource
+{
+public:
+    explicit PackedFrameSource(const std::string &pack_path, PixelFormat format = PixelFormat::Encoded) : pack_path(pack_path), format(format) {}
+
+    bool open();
+    std::string describe() const override { return "container " + pack_path; }
+    size_t frame_count() const override { return pack.frame_count(); }
+    cv::Mat first_frame() override;
+    void begin_range(size_t begin, size_t end, size_t step, FrameScratch &scratch) override;
+    FrameStatus read(size_t index, FrameScratch &scratch, FrameView &view) override;
+    void release(size_t index) override { pack.release(index); }
+    void close() override { pack.close(); }
+
+private:
+    std::string pack_path;
+    PixelFormat format;
+    PackedFrameFile pack;
+};
+
+/* Video file of an experiment folder, decoded sequentially by cv::VideoCapture */
+class VideoFrameSource : public FrameSource
+{
+public:
+    explicit VideoFrameSource(const std::string &video_path) : video_path(video_path) {}
+
+    bool open() { return capture.open(video_path); }
+    std::string describe() const override { return "video " + video_path; }
+    size_t frame_count() const override;
+    bool random_access() const override { return false; }
+    cv::Mat first_frame() override;
+    FrameStatus read(size_t index, FrameScratch &scratch, FrameView &view) override;
+    void close() override { capture.release(); }
+
+private:
+    std::string video_path;
+    cv::VideoCapture capture;
+    cv::Mat frame, gray;
+};
+
+/*
+* Header of the shared memory ring written by the acquisition. The slots follow the header, every slot holds one
+* frame of width * height * bytes_per_pixel bytes and starts at a multiple of 64 bytes.
+* - The producer writes frame N into slot N % slot_count and then increments write_count.
+* - The consumer increments read_count after it is done with a frame. The producer must not run more than slot_count
+*   frames ahead of read_count.
+* - The producer sets finished after its last frame.
+*/
+struct ShmRingHeader
+{
+    char magic[8];
+    uint32_t width, height, slot_count, bytes_per_pixel;
+    std::atomic<uint64_t> write_count;
+    std::atomic<uint64_t> read_count;
+    std::atomic<uint32_t> finished;
+};
+
+/* Shared memory ring named in frames.shm of an experiment folder, frames are used in place without any copy */
+class ShmRingSource : public FrameSource
+{
+public:
+    explicit ShmRingSource(const std::string &shm_name) : shm_name(shm_name) {}
+    ~ShmRingSource() override;
+
+    bool open();
+    std::string describe() const override { return "shared memory ring " + shm_name; }
+    size_t frame_count() const override { return 0; }
+    bool random_access() const override { return false; }
+    cv::Mat first_frame() override;
+    FrameStatus read(size_t index, FrameScratch &scratch, FrameView &view) override;
+    void release(size_t index) override;
+    void close() override;
+
+    static constexpr const char *magic = "MIGRING1";
+
+private:
+    bool wait_for(size_t index) const;
+    cv::Mat slot(size_t index) const;
+
+    std::string shm_name;
+    ShmRingHeader *header = nullptr;
+    uchar *slots = nullptr;
+    size_t slot_size = 0, mapped_size = 0;
+};
+
+/*
+* Per-frame values that do not depend on the RoI, kept across runs in FrameCache.bin inside the results folder of an
+* experiment (--cache), so that a rerun with other RoI settings only recomputes the NCC.
+* - Layout: 8 byte magic "MIGCACH1", then records of a uint64 key and a double MIG. The key is a hash of the decoded
+*   pixels combined with everything else the MIG depends on (see frame_cache_key()).
+* - Entries are loaded before any frame is processed and only read by the workers. New entries are appended by the
+*   writer of the experiment, which already runs under its lock. The writer opens 'file' at 'path' with the other
+*   outputs of the experiment and closes it after its last chunk.
+*/
+struct FrameCache
+{
+    static constexpr const char *magic = "MIGCACH1";
+
+    std::unordered_map<uint64_t, double> mig;
+    std::string path;
+    std::ofstream file;
+};
+
+/*
+* Everything needed to process one experiment folder (Gain_N/Move_N/Exp_N).
+* gain_name, move_name, exp_name: names of the Gain_N, Move_N and Exp_N folders of this experiment
+* exp_dir: path of the folder containing the frames
+* ncc_dir: path of the folder where NCC images of this experiment are saved
+* source: where the frames of this experiment are read from
+* truth: commanded movement of the Move_N folder of this experiment
+* outputs: one entry per RoI configuration, in the order of the configurations
+* cache: frame cache of this experiment, only used with --cache
+* reference: spectrum of frame_0, only for the consistency check
+* frame_size: size of frame_0
+* active: bounding box of the search windows of all RoI configurations (in tracking mode only where no filter has
+*         made a prediction yet, see track_chunk())
+* row_limit: number of frame rows that are decoded, rows below it are not used by NCC or MIG
+* busy_seconds: time workers spent on the frames of this experiment, summed over all workers
+* perf_path, perf_file: Counters.csv of this experiment, hardware counters per frame and stage (--perf-counters)
+* perf, perf_frames: hardware counters summed over the frames written so far, and their number
+* write_failed: an output file of this experiment could not be opened
+* next_frame: frame after the last one written, the filters of the RoI configurations have seen every frame before it
+* The remaining members are the state of the per-experiment writer, which buffers finished chunks and writes them to
+* Results.csv strictly in frame order, no matter in which order the workers finish them. A chunk holds one row per
+* frame and RoI configuration, the configurations of a frame next to each other. The output files are only open
+* while the writer is between the first and the last chunk of the experiment, so that the number of open files does
+* not grow with the number of experiments.
+*/
+struct Experiment
+{
+    /*
+    * RoI configuration of an experiment and what is written for it.
+    * config: position and size of the RoI
+    * roi: template taken from frame_0 of this experiment
+    * roi_f: 'roi' as float if frame_0 is not 8 bit, converted once here instead of once per frame
+    * spectrum: spectrum of 'roi', only in sweep mode
+    * window: part of the frames searched for the RoI, the whole frame without --search-margin
+    * filter: Kalman filter of the shifts written so far (--kalman, --track)
+    * preview_roi: 'roi' scaled down for the preview pass (--preview)
+    * csv_path, csv_file: Results.csv of this experiment (Results_<label>.csv in sweep mode, open only while the rows
+    *   of a chunk are written to it)
+    * summary: statistics of the rows written so far
+    */
+    struct RoiOutput
+    {
+        RoiConfig config;
+        cv::Mat roi;
+        cv::Mat roi_f;
+        TemplateSpectrum spectrum;
+        cv::Rect window;
+        ShiftFilter filter;
+        cv::Mat preview_roi;
+        std::string csv_path;
+        std::ofstream csv_file;
+        ExperimentSummary summary;
+    };
+
+    std::string gain_name, move_name, exp_name;
+    std::string exp_dir;
+    std::string ncc_dir;
+    std::unique_ptr<FrameSource> source;
+    MovementTruth truth;
+    std::vector<RoiOutput> outputs;
+    FrameCache cache;
+    FrameSpectrum reference;
+    cv::Size frame_size;
+    cv::Rect active;
+    int row_limit = 0;
+    double busy_seconds = 0;
+    std::string perf_path;
+    std::ofstream perf_file;
+    StagePerf perf;
+    size_t perf_frames = 0;
+    bool write_failed = false;
+
+    std::mutex write_mutex;
+    std::vector<std::vector<FrameRow>> chunk_rows;
+    std::vector<bool> chunk_done;
+    size_t next_chunk = 0;
+    size_t next_frame = 0;
+};
+
+/*
+* A range of frames [begin, end) of one experiment. This is the unit of work handed to the scheduler.
+* step, scale: only every step-th frame is processed, scaled by 'scale' (below 1 in the preview pass)
+* last_pass: false in the preview pass, the source of the experiment is closed after the last chunk of the last pass
+*/
+struct FrameChunk
+{
+    Experiment *exp;
+    size_t chunk_id;
+    size_t begin, end;
+    size_t step = 1;
+    double scale = 1.0;
+    bool last_pass = true;
+};
+
+/*
+* Pool of threads that read whole files into memory. Used for read-ahead when io_uring is not available.
+*/
+class IoThreadPool
+{
+public:
+    explicit IoThreadPool(unsigned num_threads);
+    ~IoThreadPool();
+
+    void enqueue(std::function<void()> job);
+
+private:
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::function<void()>> jobs;
+    std::vector<std::thread> threads;
+    bool stopping = false;
+};
+
+/*
+* Reads the frame files of a chunk ahead of the worker that decodes them.
+* - Up to 'depth' files are in flight at any time, each in its own slot buffer. next() hands out the files strictly in
+*   order and immediately starts reading the next file into the freed slot, so the worker decodes frame N while frames
+*   N+1 ... N+depth are loaded.
+* - Reads go through io_uring when the binary was built with liburing (HAVE_LIBURING) and the kernel supports it,
+*   otherwise through the shared IoThreadPool.
+* - Buffers are swapped with the caller's buffer, so once all slots reached their size no further allocation happens.
+*   Both backends size a slot on the worker before its read is issued, so its pages are first touched on the worker's
+*   NUMA node.
+*/
+class FramePrefetcher
+{
+public:
+    explicit FramePrefetcher(unsigned depth);
+    ~FramePrefetcher();
+
+    /* Starts reading the given files. Every file of the previous start() must have been taken with next(). */
+    void start(const std::vector<std::string> &paths);
+
+    /* Waits for the next file and swaps its contents into 'bytes'. Returns false if the file could not be read. */
+    bool next(std::vector<uchar> &bytes);
+
+private:
+    struct Slot
+    {
+        std::vector<uchar> bytes;
+        int fd = -1;
+        size_t done_bytes = 0;
+        bool ready = false;
+        bool ok = false;
+    };
+
+    void issue();
+    void finish(Slot &slot, bool ok);
+
+    std::vector<Slot> slots;
+    std::vector<std::string> paths;
+    size_t next_issue = 0, next_consume = 0;
+
+    /* Thread pool backend */
+    std::mutex mutex;
+    std::condition_variable ready;
+
+#ifdef HAVE_LIBURING
+    /* io_uring backend */
+    void submit_read(size_t slot_id);
+    void reap();
+
+    struct io_uring ring;
+    bool use_uring = false;
+#endif
+};
+
+/*
+* Hardware counters of the calling thread through perf_event_open: cycles, instructions, last level cache misses and
+* branch misses, counted in user space only and read together as one group. Counters the CPU or the kernel do not
+* offer (e.g. in virtual machines) stay 0.
+*/
+class PerfCounters
+{
+public:
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    /* false if not even the cycle counter could be opened (e.g. kernel.perf_event_paranoid too high) */
+    bool available() const { return !fds.empty(); }
+
+    /* Current values since the counters were opened */
+    PerfSample read() const;
+
+private:
+    std::vector<int> fds;
+    std::vector<uint64_t PerfSample::*> fields;
+};
+
+/*
+* Buffers reused by one worker for every frame it processes, so that the steady state does not allocate.
+* The constructor allocates and writes every buffer at full size. Called on the worker's own (pinned) thread, the
+* first touch places their pages on the NUMA node of that worker.
+* file_bytes: encoded frame as read from disk
+* frame: decoded frame
+* result: NCC result matrix
+* prefetcher: read-ahead of the frame files (only if enabled)
+* frame16: unpacked Mono12p frame
+* frame_f, roi_f: float copies of 16 bit frame and RoI, matchTemplate() only takes 8 bit or float (roi_f only for a
+*                 RoI that is not float yet, see Experiment::RoiOutput::roi_f)
+* spectrum: spectrum of the frame, computed once per frame and shared by all RoI configurations of a sweep
+* patch, patch_padded: spectrum of the matched patch of the frame and its padded copy, for the consistency check
+*                      (patch_padded is the patch as float when it is matched in a small search window instead)
+* peak_blocks: blocks of the PeakScan of the current result matrix
+* preview: scaled down frame of the preview pass
+* perf: hardware counters of the worker's thread (only with --perf-counters and if the kernel allows them)
+* perf_thread: thread 'perf' counts, the counters count only the thread that opened them
+* range_step: step of the range of frames the worker reads (see FrameSource::begin_range())
+* columns: fields of the rows of a chunk, one column each, for fill_distances()
+* product, correlation: spectrum product and cross correlation of one RoI configuration
+*/
+struct FrameScratch
+{
+    FrameScratch();
+
+    /* Opens 'perf' on the calling thread (with --perf-counters), replacing the counters of an earlier thread */
+    void open_perf_counters();
+
+    std::vector<uchar> file_bytes;
+    cv::Mat frame;
+    cv::Mat result;
+    std::unique_ptr<FramePrefetcher> prefetcher;
+    cv::Mat frame16;
+    cv::Mat1f frame_f, roi_f;
+    FrameSpectrum spectrum;
+    TemplateSpectrum patch;
+    cv::Mat1f patch_padded;
+    cv::Mat product, correlation;
+    std::vector<PeakScan::Block> peak_blocks;
+    cv::Mat preview;
+    std::unique_ptr<PerfCounters> perf;
+    std::thread::id perf_thread;
+    size_t range_step = 1;
+    std::vector<double> columns;
+};
+
+/*
+* Per pixel type choices of the MIG and NCC kernels. MIG gets its own compiled kernel per depth; NCC goes through
+* matchTemplate(), which only takes 8 bit and float, so 16 bit frames are converted to float for it.
+* depth: OpenCV depth of frames with this pixel type
+* Gradient: integer type wide enough for 3x3 Sobel sums of this pixel type
+* native_match: true if matchTemplate() takes frames of this depth as they are, otherwise they are matched as float
+*/
+template <typename Pixel>
+struct DepthTraits;
+
+template <>
+struct DepthTraits<uchar>
+{
+    static constexpr int depth = CV_8U;
+    using Gradient = int16_t;
+    static constexpr bool native_match = true;
+};
+
+template <>
+struct DepthTraits<uint16_t>
+{
+    static constexpr int depth = CV_16U;
+    using Gradient = int32_t;
+    static constexpr bool native_match = false;
+};
+
+/*
+* CPUs of every NUMA node, as listed in /sys/devices/system/node. Only CPUs this process is allowed to run on are kept.
+* Machines without that information are reported as a single node holding all allowed CPUs.
+*/
+struct CpuTopology
+{
+    std::vector<std::vector<int>> node_cpus;
+};
+
+/*
+* Work-stealing scheduler for frame chunks.
+* - Every worker owns a deque of chunks. It takes work from the front of its own deque and, once that is empty, steals
+*   from the back of the other workers' deques. Workers therefore stay busy until the whole batch is done, instead of
+*   idling while one worker is still stuck on a large experiment.
+* - All chunks are submitted before run() is called and chunks never spawn new chunks, so a worker may exit as soon as
+*   it finds every deque empty.
+* - Optionally every worker is pinned to a CPU. Thieves then prefer victims on their own NUMA node, so that chunks only
+*   cross nodes when the local node has run dry.
+*/
+class WorkStealingScheduler
+{
+public:
+    explicit WorkStealingScheduler(unsigned num_workers);
+
+    /* Queues a chunk on the next worker (round robin). Must be called before run(). */
+    void submit(const FrameChunk &chunk);
+
+    /* Pins worker i to worker_cpus[i], which lies on NUMA node worker_nodes[i]. Must be called before run(). */
+    void set_placement(const std::vector<int> &worker_cpus, const std::vector<int> &worker_nodes);
+
+    /* Starts the workers and blocks until every submitted chunk was processed by 'work'. */
+    void run(const std::function<void(const FrameChunk &chunk, unsigned worker_id)> &work);
+
+    unsigned size() const { return static_cast<unsigned>(queues.size()); }
+
+private:
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        std::deque<FrameChunk> chunks;
+    };
+
+    bool pop_local(unsigned worker_id, FrameChunk &chunk);
+    bool steal(unsigned worker_id, FrameChunk &chunk);
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    unsigned next_queue = 0;
+    std::vector<int> worker_cpus;
+    std::vector<int> worker_nodes;
+};
+
+/*
+* How the cores are shared between our workers and OpenCV's internal thread pool.
+* Outer: one worker per core, OpenCV runs single threaded (cv::setNumThreads(1)). Best when there are many frames.
+* Inner: a single worker, OpenCV parallelizes every matchTemplate/Sobel call. Best for a handful of frames.
+* Auto: Outer from outer_frames_per_core frames per core on, otherwise Inner.
+*/
+enum class ThreadingPolicy
+{
+    Auto,
+    Outer,
+    Inner
+};
+
+/*
+* Options given on the command line.
+* images_dir: folder that contains all the experiments and the images
+* num_workers: number of cores to use (0 -> all cores)
+* threading: threading policy, see ThreadingPolicy
+* bench_threading: run the threading benchmark instead of processing the images
+* synthetic_dir: write a synthetic experiment to this folder instead of processing the images (empty -> off)
+* verify: run the accuracy check of the fast paths instead of processing the images
+* perf_counters: count cycles, instructions, LLC misses and branch misses of decoding, MIG and NCC (Counters.csv)
+* memory_stats: account allocations per stage and write them with the peak RSS to Memory.csv (operator new only in
+*   builds with MIG_MEMORY_STATS, cv::Mat buffers always)
+* bench_json: run the benchmarks and write their results to this JSON file (empty -> off)
+* bench_baseline, bench_current: compare these two benchmark JSON files (empty -> off)
+* pin_workers: pin every worker to one CPU, spread evenly over the NUMA nodes (see place_workers())
+* prefetch_depth: number of frame files each worker reads ahead (0 -> synchronous reads)
+* io_threads: number of reader threads used for read-ahead when io_uring is not available
+* pack_frames: write a frames.pack for every experiment that has none yet, and read the frames from it
+* png_8bit: decode PNGs to 8 bit like cv::IMREAD_GRAYSCALE alone does, instead of keeping 16 bit PNGs at 16 bit
+* xlsx: also write the summary of the run as an Excel workbook
+* sweep: RoI configurations evaluated in one pass (--sweep <file>), empty for the single default RoI
+* cache: take the MIG of frames seen in an earlier run from the frame cache of the experiment (see FrameCache)
+* search_margin: search the RoI only within this many pixels around its position in frame_0 (negative -> whole frame)
+* mig_window: compute the MIG over the search windows only, so that frame rows below them need not be decoded
+* auto_roi: place every RoI on the most textured spot of frame_0 of each experiment instead of its given position
+* auto_roi_center: fraction of the frame width and height, around the center, that an automatically placed RoI must lie in
+* consistency: check every match by matching the found patch back into frame_0 (see forward_backward_consistent())
+* consistency_tolerance: distance in pixels, per axis, by which the backward match may miss the RoI's position
+* kalman: write the shifts filtered by a constant velocity Kalman filter and its innovation to Results.csv
+* kalman_q, kalman_r: process noise (pixels^2 per frame^2) and measurement noise (pixels^2) of the filter
+* track: center the search window of every frame on the position the filter predicts from the previous frames
+* preview_step, preview_scale: before the full pass, process every preview_step-th frame scaled by preview_scale and
+*                              write provisional results (preview_step 0 -> no preview)
+* skip_static: mean absolute difference to the last processed frame, in 8 bit gray levels, up to which a frame reuses
+*              its results instead of being matched (negative -> every frame is matched)
+*/
+struct Settings
+{
+    std::string images_dir = "../laser_decorrelation_images";
+    unsigned num_workers = 0;
+    ThreadingPolicy threading = ThreadingPolicy::Auto;
+    bool bench_threading = false;
+    std::string synthetic_dir;
+    bool verify = false;
+    bool perf_counters = false;
+    bool memory_stats = false;
+    std::string bench_json;
+    std::string bench_baseline, bench_current;
+    bool pin_workers = false;
+    unsigned prefetch_depth = 4;
+    unsigned io_threads = 4;
+    bool pack_frames = false;
+    bool png_8bit = false;
+    bool xlsx = false;
+    std::vector<RoiConfig> sweep;
+    bool cache = false;
+    int search_margin = -1;
+    bool mig_window = false;
+    bool auto_roi = false;
+    double auto_roi_center = 1.0;
+    bool consistency = false;
+    int consistency_tolerance = 1;
+    bool kalman = false;
+    double kalman_q = 0.05;
+    double kalman_r = 1.0;
+    bool track = false;
+    size_t preview_step = 0;
+    double preview_scale = 0.5;
+    double skip_static = -1;
+};
+
+/*
+* This function reads the command line options into the global settings.
+
+* func: parse_settings()
+* param: arguments of main()
+* return: true if all options were valid
+*/
+bool parse_settings(int argc, char **argv);
+
+/*
+* This function reads the RoI configurations of a sweep, one "x y w h" per line. Empty lines and lines starting with
+* '#' are skipped.
+
+* func: read_sweep()
+* param:
+    - path of the sweep file
+    - configurations read
+* return: true if the file was read and every configuration is valid
+*/
+bool read_sweep(const std::string &path, std::vector<RoiConfig> &configs);
+
+/*
+* This function picks the threading policy for a batch and configures OpenCV's thread pool accordingly.
+
+* func: apply_threading_policy()
+* param:
+    - requested threading policy
+    - number of frames in the batch that workers can share, a stream counts as one
+* return: number of workers to start
+*/
+unsigned apply_threading_policy(ThreadingPolicy policy, size_t num_frames);
+
+/*
+* This function times the per-frame kernels of process_chunk() (fused MIG, NCC and peak scan, with the buffers of a
+* FrameScratch per worker) on synthetic 728x544 frames with the Outer and the Inner threading policy for a growing
+* number of frames and prints where Outer starts to win, in frames per core as outer_frames_per_core expects it.
+
+* func: run_threading_benchmark()
+* param: void
+* return: 0 or 1
+*/
+int run_threading_benchmark();
+
+/*
+* This function writes a synthetic experiment in the folder structure of the images: blurred speckle moving by a
+* fixed number of pixels per frame, with the movement.txt that matches it. It is the training run of the PGO build
+* and a dataset with a known answer.
+
+* func: write_synthetic_experiment()
+* param: folder to write Gain_1/Move_1/Exp_1 into
+* return: 0 or 1
+*/
+int write_synthetic_experiment(const std::string &root_path);
+
+/*
+* This function creates the speckle field of the synthetic experiment. Frame N is the frame sized crop at
+* (margin - N * synthetic_step_col, margin - N * synthetic_step_row), so the speckle moves by one step per frame.
+
+* func: synthetic_field()
+* param: margin around the crop of frame 0, in pixels
+* return: 8 bit speckle field, the same for every call
+*/
+cv::Mat synthetic_field(int margin);
+
+/*
+* This function checks the fast paths against the reference path (get_results() and mig_frame() without buffers,
+* i.e. matchTemplate + minMaxLoc and cv::Sobel) on the synthetic experiment. It prints the largest shift
+* disagreement, confidence deviation and relative MIG error of every path and fails if one is above its bound.
+* Every path is checked with the default, centred RoI, with a small one off the center and with the RoI --auto-roi
+* places.
+
+* func: run_accuracy_check()
+* param: void
+* return: 0 if every path is within its bounds, 1 otherwise
+*/
+int run_accuracy_check();
+
+/*
+* This function times mig_frame(), get_results() and the whole per frame work (PNG decoding, MIG and NCC) on the
+* synthetic frames on one core, several times each, and writes the frames per second of every repetition to a JSON
+* file tagged with the git commit and the CPU model.
+
+* func: run_benchmarks()
+* param: path of the JSON file
+* return: 0 or 1
+*/
+int run_benchmarks(const std::string &json_path);
+
+/*
+* This function compares two benchmark JSON files. A benchmark is flagged as a regression when its frames per second
+* dropped and a one sided permutation test on the repetitions gives p < 0.01.
+
+* func: compare_benchmarks()
+* param:
+    - JSON file of the baseline
+    - JSON file of the run to check
+* return: 0 if nothing regressed, 1 on a regression or an unreadable file
+*/
+int compare_benchmarks(const std::string &baseline_path, const std::string &current_path);
+
+/*
+* This function reads a JSON file written by run_benchmarks(). It only understands that layout.
+
+* func: read_benchmarks()
+* param:
+    - path of the JSON file
+    - receives the run
+* return: true on success
+*/
+bool read_benchmarks(const std::string &path, BenchmarkRun &run);
+
+/*
+* This function tests whether the values of 'current' are lower than those of 'baseline' by chance: the probability,
+* under random relabeling of all values, of a drop of the mean at least as large as the observed one.
+
+* func: permutation_p_value()
+* param:
+    - values of the baseline
+    - values of the run to check
+* return: one sided p value
+*/
+double permutation_p_value(const std::vector<double> &baseline, const std::vector<double> &current);
+
+/*
+* This function reads the model name of the first CPU.
+
+* func: cpu_model()
+* param: void
+* return: model name, "unknown" if /proc/cpuinfo has none
+*/
+std::string cpu_model();
+
+/*
+* This function reads the NUMA topology of the machine.
+
+* func: read_cpu_topology()
+* param: void
+* return: CPUs per NUMA node
+*/
+CpuTopology read_cpu_topology();
+
+/*
+* This function parses a Linux CPU list such as "0-3,8,10-11".
+
+* func: parse_cpu_list()
+* param: CPU list as found in /sys/devices/system/node/nodeN/cpulist
+* return: CPU numbers
+*/
+std::vector<int> parse_cpu_list(const std::string &cpu_list);
+
+/*
+* This function places the workers of a scheduler on the CPUs of the machine and prints the chosen topology. The
+* workers are spread evenly over all CPUs, listed node after node, so that every NUMA node gets a share of the workers
+* proportional to its number of CPUs (and its memory bandwidth is used) while neighbouring workers share a node.
+
+* func: place_workers()
+* param: scheduler whose workers are placed
+* return: void
+*/
+void place_workers(WorkStealingScheduler &scheduler);
+
+/* 
+* This function goes recursively through the directory containing images and uses other functions to calculate and save NCC results.
+* func: recursive_folders()
+* param: relative path with respect to build folder
+* return: 0 or 1
+*/
+int recursive_folders(const std::string &root_path);
+
+/*
+* This function calculates MIG and NCC for all frames of a chunk and hands the rows to the writer of the experiment.
+
+* func: process_chunk()
+* param:
+    - chunk of frames to process
+    - buffers of the worker processing the chunk
+* return: void
+*/
+void process_chunk(const FrameChunk &chunk, FrameScratch &scratch);
+
+/*
+* This function computes the provisional rows of one frame in the preview pass: the frame is scaled down like the RoIs,
+* MIG and NCC run on the small frame and the match is scaled back to full resolution pixels.
+
+* func: preview_frame()
+* param:
+    - experiment of the frame
+    - frame number
+    - frame at full resolution
+    - scale of the preview pass
+    - buffers of the worker
+    - receives one row per RoI configuration
+* return: void
+*/
+void preview_frame(const Experiment &exp, size_t index, const cv::Mat &img, double scale, FrameScratch &scratch, std::vector<FrameRow> &rows);
+
+/*
+* This function (re)creates the Results.csv of a RoI configuration and writes its header.
+
+* func: open_results()
+* param: RoI configuration whose csv_path is set
+* return: true on success
+*/
+bool open_results(Experiment::RoiOutput &output);
+
+/*
+* This function (re)creates the Counters.csv of an experiment and writes its header.
+
+* func: open_counters()
+* param: experiment whose perf_path is set
+* return: true on success
+*/
+bool open_counters(Experiment &exp);
+
+/*
+* This function (re)creates the csv files of an experiment and opens its frame cache for appending. The writer calls
+* it before the first chunk of a pass, a failure is logged and marks the experiment.
+
+* func: open_outputs()
+* param: experiment whose csv_path, perf_path and cache path are set
+* return: true on success
+*/
+bool open_outputs(Experiment &exp);
+
+/*
+* This function closes the output files of an experiment after the last chunk of a pass was written.
+
+* func: close_outputs()
+* param: experiment
+* return: void
+*/
+void close_outputs(Experiment &exp);
+
+/*
+* This function adds an allocation to the memory statistics of a stage.
+
+* func: record_allocation()
+* param:
+    - stage the allocation is charged to
+    - size in bytes
+* return: void
+*/
+void record_allocation(MemoryStage stage, size_t bytes);
+
+/*
+* This function removes a freed allocation from the live memory of the stage it was charged to.
+
+* func: record_release()
+* param:
+    - stage the allocation was charged to
+    - size in bytes
+* return: void
+*/
+void record_release(MemoryStage stage, size_t bytes);
+
+/*
+* This function writes the memory statistics of the run per stage, allocations per frame and the peak RSS of the
+* process to Memory.csv in the results folder and prints them.
+
+* func: write_memory_report()
+* param: void
+* return: 0 or 1
+*/
+int write_memory_report();
+
+/*
+* This function converts the pixel shifts of a batch of rows to mm and compares them with the commanded movement.
+* Frames that were not matched (confidence 0) get no error. It runs once per chunk over all its rows. The fields it reads and writes are copied into one column each, so that
+* the arithmetic runs in loops over contiguous doubles that the compiler vectorizes.
+
+* func: fill_distances()
+* param:
+    - rows of a chunk, with their frame numbers and NCC results filled in
+    - commanded movement of the experiment
+    - buffer for the columns, reused from chunk to chunk
+* return: void
+*/
+void fill_distances(std::vector<FrameRow> &rows, const MovementTruth &truth, std::vector<double> &columns);
+
+/*
+* This function reads the movement.txt of a Move_N folder (see MovementTruth).
+
+* func: read_movement()
+* param: path of the Move_N folder
+* return: commanded movement, not valid if there is no movement.txt
+*/
+MovementTruth read_movement(const std::string &movement_dir);
+
+/*
+* This function stores the rows of a finished chunk and writes every chunk that is now next in frame order to the
+* Results.csv of the experiment. Safe to call from several workers at once.
+
+* func: commit_chunk()
+* param:
+    - chunk that was processed
+    - rows computed for the frames of that chunk
+    - time the worker spent on the chunk
+* return: void
+*/
+void commit_chunk(const FrameChunk &chunk, std::vector<FrameRow> &&rows, double busy_seconds);
+
+/* 
+* This function calculates MIG (Mean Intensity Gradient) for a single frame and return that value.
+
+* func: mig_frame()
+* param: reference to an OpenCV matrix object
+* return: MIG value of type double for the given frame
+*/
+double mig_frame(const cv::Mat &frame);
+
+/*
+* Same as mig_frame() above, but for 8 and 16 bit frames Sobel, magnitude and sum run fused in one pass of the
+* kernel for that depth (mig_kernel()), without any gradient buffers. Other depths take the path of mig_frame().
+*/
+double mig_frame(const cv::Mat &frame, FrameScratch &scratch);
+
+/*
+* This function creates (recursive) folders.
+
+* func: create_folders()
+* param: path relative to build folder
+* return: void
+*/
+void create_folders(const std::string &path);
+
+/*
+* This function gets Region of Interest (RoI) from a frame which would be used as template to perform template matching.
+
+* func: get_roi()
+* param: 
+    - reference to OpenCV frame/matrix object
+    - width of RoI
+    - height of RoI
+    - Coordinates of top left corner of RoI
+* return: OpenCV frame/matrix object 
+*/
+cv::Mat get_roi(cv::Mat &frame, const int &width, const int &height, const int &topLeft_x, const int &topLeft_y);
+
+/*
+* This function computes the integral image of the gradient energy (squared 3x3 Sobel gradients) of a frame, which
+* gives the texture of any window of the frame in O(1).
+
+* func: texture_integral()
+* param: frame
+* return: integral image (CV_64F, one row and column larger than the frame)
+*/
+cv::Mat texture_integral(const cv::Mat &frame);
+
+/*
+* This function finds the window of the given size with the most texture, i.e. the largest gradient energy, within
+* the central part of the frame. Every position is evaluated once from the integral image, so the search is
+* O(pixels) whatever the size of the window.
+
+* func: place_roi()
+* param:
+    - integral image from texture_integral()
+    - width and height of the RoI
+    - fraction of the frame width and height, around the center, that the RoI must lie in (1 -> whole frame)
+* return: top left corner of the chosen RoI
+*/
+cv::Point place_roi(const cv::Mat &energy_integral, const int &width, const int &height, double center);
+
+/*
+* This function performs NCC template matching and returns the results from the match.
+
+* func: get_results
+* param: 
+    - reference to OpenCV frame object
+    - reference of OpenCV RoI object
+    - width and height of frame
+    - width and height of RoI
+* return: struct type LocAndConf
+*/
+LocAndConf get_results(cv::Mat &frame, cv::Mat &roi, const int &frameWidth, const int &frameHeight, const int &width, const int &height);
+
+/*
+* Same as get_results() above, but matches the frame in place and keeps the result matrix in the given buffers.
+* Dispatches on the depth of the frame to match_kernel(), 8 and 16 bit frames are supported (16 bit as float, see
+* match_kernel()). The shifts are measured
+* from origin, where the RoI was taken from in the coordinates of the frame searched, so that a RoI anywhere in the
+* frame has no shift where it was taken from.
+*/
+LocAndConf get_results(const cv::Mat &frame, const cv::Mat &roi, const cv::Point &origin, FrameScratch &scratch);
+
+/*
+* This function computes what the spectral NCC of a frame needs from the frame alone: its DFT, zero padded to
+* get_dft_size(), and the integral image of its squared pixels. Done once per frame for all RoI configurations.
+
+* func: frame_spectrum()
+* param:
+    - frame
+    - receives the spectrum, reusing its buffers
+* return: void
+*/
+void frame_spectrum(const cv::Mat &frame, FrameSpectrum &spectrum);
+
+/*
+* This function computes the spectrum of a RoI for frames of the given size.
+
+* func: template_spectrum()
+* param:
+    - RoI
+    - size of the frames it is matched against
+    - buffer for the padded RoI
+    - receives spectrum and norm of the RoI
+* return: void
+*/
+void template_spectrum(const cv::Mat &roi, const cv::Size &frame_size, cv::Mat1f &padded, TemplateSpectrum &roi_spectrum);
+
+/*
+* This function returns the size frames of the given size are padded to for their DFT.
+
+* func: get_dft_size()
+* param: size of the frames
+* return: padded size, at least as large as the frames
+*/
+cv::Size get_dft_size(const cv::Size &frame_size);
+
+/*
+* This function performs NCC template matching like get_results() (TM_CCORR_NORMED), from the spectrum of the frame
+* computed by frame_spectrum(): the cross correlation is one spectrum product and one inverse DFT, the energy of every
+* window comes from the integral image. The maximum is searched in the same pass that normalizes the correlation.
+
+* func: match_spectral()
+* param:
+    - spectrum of the frame searched
+    - spectrum of the RoI
+    - width and height of the RoI
+    - part of the frame searched for the RoI
+    - where the RoI was taken from, the shifts are measured from it
+    - buffers of the worker
+* return: struct type LocAndConf
+*/
+LocAndConf match_spectral(const FrameSpectrum &frame, const TemplateSpectrum &roi_spectrum, const int &width, const int &height, const cv::Rect &window, const cv::Point &origin, FrameScratch &scratch);
+
+/*
+* This function checks a match by matching back: the patch of the frame where the RoI was found is searched in
+* frame_0 within the same search window, and has to come back to where the RoI was taken from. A false peak on
+* repetitive speckle usually does not.
+* Cost per frame and RoI: with a search window smaller than half of frame_0 (--search-margin), the patch is matched
+* with matchTemplate() in frame_0 within the window only, i.e. DFTs of about the window size (160x160 for the default
+* RoI and a margin of 16, roughly a tenth of the frame sized DFTs). Otherwise the spectrum and integral image of
+* frame_0, computed once per experiment, are reused, and the check costs one frame sized DFT of the zero padded patch,
+* one spectrum product and one frame sized inverse DFT.
+
+* func: forward_backward_consistent()
+* param:
+    - frame
+    - forward match of the RoI in the frame
+    - experiment, holding the spectrum of frame_0
+    - RoI configuration that was matched
+    - buffers of the worker
+* return: true if the backward match lands within the tolerance of the RoI's position
+*/
+bool forward_backward_consistent(const cv::Mat &frame, const LocAndConf &forward, const Experiment &exp, const Experiment::RoiOutput &output, FrameScratch &scratch);
+
+/*
+* This function samples a part of a frame on a grid of every 8th pixel and compares the samples with those of an
+* earlier frame. It costs about 1/64 of a pass over the pixels, far less than the NCC it can save.
+
+* func: frame_change()
+* param:
+    - frame, 8 or 16 bit
+    - significant bits of its pixels (see FrameView::significant_bits())
+    - part of the frame to sample
+    - receives the samples of the frame
+    - samples of the earlier frame
+* return: mean absolute difference in 8 bit gray levels, infinity if there is no earlier frame of the same size
+*/
+double frame_change(const cv::Mat &frame, int bits, const cv::Rect &area, std::vector<float> &grid, const std::vector<float> &previous);
+
+/*
+* This function returns the search window of a RoI in tracking mode: the RoI at the position its filter predicts for
+* the current frame, grown by --search-margin and clipped to the frame. Before the filter has seen a frame, the whole
+* frame is searched.
+
+* func: tracking_window()
+* param:
+    - RoI configuration
+    - filter of the frames matched so far
+    - size of the frames
+* return: search window
+*/
+cv::Rect tracking_window(const RoiConfig &config, const ShiftFilter &tracker, const cv::Size &frame_size);
+
+/*
+* This function starts the predictors of a chunk in tracking mode from the filters of the writer, which has seen the
+* frames up to exp.next_frame, and predicts them forward at constant velocity to the first frame of the chunk. It
+* returns the part of the frame the search windows can reach in the chunk: the windows predicted for its first and
+* its last frame, grown by three standard deviations of the prediction at the last frame. That is the whole frame
+* while a filter has not seen a match yet, and for streams, whose only chunk has no known end.
+
+* func: track_chunk()
+* param:
+    - experiment, its write lock must not be held
+    - first and end frame of the chunk
+    - receives one predictor per RoI configuration
+* return: part of the frame searched in the chunk
+*/
+cv::Rect track_chunk(Experiment &exp, size_t begin, size_t end, std::vector<ShiftFilter> &trackers);
+
+/*
+* This function returns the part of the frame searched for a RoI: the RoI grown by --search-margin on every side and
+* clipped to the frame, or the whole frame without a margin.
+
+* func: search_window()
+* param:
+    - RoI configuration
+    - size of the frames
+* return: search window
+*/
+cv::Rect search_window(const RoiConfig &config, const cv::Size &frame_size);
+
+/*
+* This function writes one row per experiment and RoI configuration with mean, standard deviation, minimum and
+* maximum of every Results.csv column to Summary.csv (and to a worksheet of Summary.xlsx if enabled) inside the results folder.
+
+* func: write_summary()
+* param: all experiments of the run
+* return: 0 or 1
+*/
+int write_summary(const std::vector<std::unique_ptr<Experiment>> &experiments);
+
+/*
+* This function compares the experiments of the run: for every metric (mean confidence, MIG, distances, their spread
+* and frames/s) a table with one row per Gain_N/Move_N (and RoI configuration of a sweep) and one column per Exp_N is
+* written to Report.csv inside the
+* results folder and printed. It only uses the statistics accumulated during the run.
+
+* func: write_report()
+* param: all experiments of the run
+* return: 0 or 1
+*/
+int write_report(const std::vector<std::unique_ptr<Experiment>> &experiments);
+
+/*
+* This function orders folder names like Gain_2 < Gain_10 by the number in them, other names alphabetically.
+
+* func: natural_less()
+* param: two folder names
+* return: true if a comes before b
+*/
+bool natural_less(const std::string &a, const std::string &b);
+
+/*
+* This function picks the frame source of an experiment folder: frames.shm (name of a shared memory ring),
+* frames.pack, a video file (frames.avi/.mp4/.mkv) or, if none of those exists or can be opened, the PNG files.
+
+* func: open_frame_source()
+* param:
+    - experiment folder
+    - names of the PNG files in it, sorted by frame number
+* return: the frame source
+*/
+std::unique_ptr<FrameSource> open_frame_source(const std::string &exp_dir, const std::vector<std::string> &file_names);
+
+/*
+* This function turns a FrameView into a grayscale frame. Encoded frames are decoded into the buffers of the worker,
+* raw frames are returned without copying.
+
+* func: decode_frame()
+* param:
+    - frame as handed out by a FrameSource
+    - number of rows needed from the top of the frame
+    - buffers of the worker
+* return: the first 'row_limit' rows of the frame (all of them if it has fewer), empty if it could not be read or
+*         decoded
+*/
+cv::Mat decode_frame(const FrameView &view, int row_limit, FrameScratch &scratch);
+
+/*
+* This function turns the bytes of a frame into a frame. Mono8 is wrapped without copying, Mono12p is unpacked into
+* 'unpacked' and encoded frames are decoded into 'decoded'. Only the first 'row_limit' rows are produced: raw frames
+* are unpacked that far and plain grayscale PNGs are decoded row by row with libpng (if available) up to there.
+
+* func: decode_bytes()
+* param:
+    - bytes of the frame and their layout
+    - number of rows needed from the top of the frame
+    - buffers for unpacked (16 bit) and decoded frames
+* return: the first 'row_limit' rows of the frame, empty if the bytes do not form a frame
+*/
+cv::Mat decode_bytes(const uchar *data, size_t size, PixelFormat format, int row_limit, cv::Mat &unpacked, cv::Mat &decoded);
+
+/*
+* This function tells the layout of a raw frame file from its size (see FileTreeSource).
+
+* func: raw_format_from_size()
+* param: size of the file in bytes
+* return: Mono8 or Mono12p, Encoded if the size fits neither
+*/
+PixelFormat raw_format_from_size(size_t size);
+
+/*
+* This function unpacks Mono12p pixels into 16 bit pixels. Uses AVX2 or SSSE3 shuffles when the CPU has them.
+
+* func: unpack_mono12p()
+* param:
+    - packed bytes (3 bytes per 2 pixels)
+    - destination pixels
+    - number of pixels (even)
+* return: void
+*/
+void unpack_mono12p(const uchar *src, uint16_t *dst, size_t num_pixels);
+
+/* Versions of unpack_mono12p() for one instruction set each, so that --verify can compare all that the CPU runs */
+static void unpack_mono12p_scalar(const uchar *src, uint16_t *dst, size_t num_pixels);
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("ssse3"))) static void unpack_mono12p_ssse3(const uchar *src, uint16_t *dst, size_t num_pixels);
+__attribute__((target("avx2"))) static void unpack_mono12p_avx2(const uchar *src, uint16_t *dst, size_t num_pixels);
+#endif
+
+#ifdef HAVE_LIBPNG
+/* Row limited PNG decoding of decode_bytes(), see its definition */
+static int decode_png_rows(const uchar *data, size_t size, int row_limit, cv::Mat &decoded);
+#endif
+
+/*
+* This function splits an experiment into chunks. Streams are never split.
+
+* func: chunk_count()
+* param: experiment
+* return: number of chunks
+*/
+size_t chunk_count(const Experiment &exp);
+
+/*
+* This function writes the given PNG files, in the given order, into a packed frame container (see PackedFrameFile).
+
+* func: write_frame_pack()
+* param:
+    - path of the container to write
+    - paths of the frame files
+* return: true on success
+*/
+bool write_frame_pack(const std::string &pack_path, const std::vector<std::string> &frame_paths);
+
+/*
+* This function returns the reader threads shared by all prefetchers, starting them on first use.
+
+* func: io_thread_pool()
+* param: void
+* return: reference to the pool
+*/
+IoThreadPool &io_thread_pool();
+
+/*
+* This function loads the entries of a frame cache file and prepares it for appending, creating it if it does not
+* exist. A truncated last record (interrupted run) is cut off. The file is opened by the writer (see open_outputs()).
+
+* func: open_frame_cache()
+* param:
+    - path of FrameCache.bin
+    - cache that receives the entries and the path
+* return: true if the file could be prepared
+*/
+bool open_frame_cache(const std::string &path, FrameCache &cache);
+
+/*
+* This function computes the frame cache key of a frame: a 64 bit hash of its pixels, seeded with its size, depth and
+* the version of the MIG kernel, so that entries never outlive a change of anything the MIG depends on.
+
+* func: frame_cache_key()
+* param: frame
+* return: key, never 0
+*/
+uint64_t frame_cache_key(const cv::Mat &frame);
+
+/*
+* This function reads a whole file into a byte buffer, reusing the capacity of the buffer.
+
+* func: read_file()
+* param:
+    - path of the file
+    - buffer that receives the bytes
+* return: true if the file was read completely
+*/
+bool read_file(const std::string &path, std::vector<uchar> &bytes);
+
+/* Options of this run, set once in main() before any worker is started */
+static Settings settings;
+
+/* Memory accounting (--memory-stats). Constant initialized, so that allocations before main() find it ready.
+   operator new and delete are only replaced in builds with MIG_MEMORY_STATS (cmake -DMIG_MEMORY_STATS=ON), other
+   builds keep the standard allocator and count cv::Mat buffers only. */
+#ifdef MIG_MEMORY_STATS
+static constexpr bool memory_counts_new = true;
+#else
+static constexpr bool memory_counts_new = false;
+#endif
+static std::atomic<bool> memory_accounting{false};
+static MemoryCounters memory_counters[static_cast<size_t>(MemoryStage::Count)];
+static thread_local MemoryStage memory_stage = MemoryStage::Other;
+static std::atomic<uint64_t> memory_frames{0};
+
+/* Main */
+int main(int argc, char **argv)
+{
+    if (!parse_settings(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    /* Counting from here on. The allocator is never destroyed, every buffer it handed out may still be freed. */
+    if (settings.memory_stats)
+    {
+        memory_accounting = true;
+        cv::Mat::setDefaultAllocator(new CountingMatAllocator());
+        if (!memory_counts_new)
+        {
+            std::cerr << "/// operator new is not counted in this build (cmake -DMIG_MEMORY_STATS=ON), Memory.csv holds cv::Mat buffers only" << std::endl;
+        }
+    }
+
+    if (settings.bench_threading)
+    {
+        return run_threading_benchmark();
+    }
+
+    if (!settings.synthetic_dir.empty())
+    {
+        return write_synthetic_experiment(settings.synthetic_dir);
+    }
+
+    if (settings.verify)
+    {
+        return run_accuracy_check();
+    }
+
+    if (!settings.bench_json.empty())
+    {
+        return run_benchmarks(settings.bench_json);
+    }
+
+    if (!settings.bench_baseline.empty())
+    {
+        return compare_benchmarks(settings.bench_baseline, settings.bench_current);
+    }
+
+    // Give the absolute path of folder that contains all the experiments and the images (--images <path>)
+    return recursive_folders(settings.images_dir);
+}
+
+bool parse_settings(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--images" && has_value)
+        {
+            settings.images_dir = argv[++i];
+        } else if (arg == "--threads" && has_value)
+        {
+            settings.num_workers = static_cast<unsigned>(std::stoul(argv[++i]));
+        } else if (arg == "--threading" && has_value)
+        {
+            std::string policy = argv[++i];
+            if (policy == "auto")
+            {
+                settings.threading = ThreadingPolicy::Auto;
+            } else if (policy == "outer")
+            {
+                settings.threading = ThreadingPolicy::Outer;
+            } else if (policy == "inner")
+            {
+                settings.threading = ThreadingPolicy::Inner;
+            } else
+            {
+                std::cerr << "/// Unknown threading policy          :       " << policy << std::endl;
+                return false;
+            }
+        } else if (arg == "--bench-threading")
+        {
+            settings.bench_threading = true;
+        } else if (arg == "--make-synthetic" && has_value)
+        {
+            settings.synthetic_dir = argv[++i];
+        } else if (arg == "--verify")
+        {
+            settings.verify = true;
+        } else if (arg == "--perf-counters")
+        {
+            settings.perf_counters = true;
+        } else if (arg == "--memory-stats")
+        {
+            settings.memory_stats = true;
+        } else if (arg == "--bench" && has_value)
+        {
+            settings.bench_json = argv[++i];
+        } else if (arg == "--bench-compare" && i + 2 < argc)
+        {
+            settings.bench_baseline = argv[++i];
+            settings.bench_current = argv[++i];
+        } else if (arg == "--pin")
+        {
+            settings.pin_workers = true;
+        } else if (arg == "--pack")
+        {
+            settings.pack_frames = true;
+        } else if (arg == "--png-8bit")
+        {
+            settings.png_8bit = true;
+        } else if (arg == "--xlsx")
+        {
+            settings.xlsx = true;
+        } else if (arg == "--cache")
+        {
+            settings.cache = true;
+        } else if (arg == "--mig-window")
+        {
+            settings.mig_window = true;
+        } else if (arg == "--consistency")
+        {
+            settings.consistency = true;
+        } else if (arg == "--consistency-tolerance" && has_value)
+        {
+            settings.consistency = true;
+            settings.consistency_tolerance = std::max(0, std::stoi(argv[++i]));
+        } else if (arg == "--auto-roi")
+        {
+            settings.auto_roi = true;
+        } else if (arg == "--auto-roi-center" && has_value)
+        {
+            settings.auto_roi = true;
+            settings.auto_roi_center = std::stod(argv[++i]);
+            if (!(settings.auto_roi_center > 0 && settings.auto_roi_center <= 1))
+            {
+                std::cerr << "/// --auto-roi-center must be in (0, 1]" << std::endl;
+                return false;
+            }
+        } else if (arg == "--search-margin" && has_value)
+        {
+            settings.search_margin = std::stoi(argv[++i]);
+        } else if (arg == "--prefetch" && has_value)
+        {
+            settings.prefetch_depth = static_cast<unsigned>(std::stoul(argv[++i]));
+        } else if (arg == "--io-threads" && has_value)
+        {
+            settings.io_threads = std::max(1u, static_cast<unsigned>(std::stoul(argv[++i])));
+        } else if (arg == "--sweep" && has_value)
+        {
+            if (!read_sweep(argv[++i], settings.sweep))
+            {
+                return false;
+            }
+        } else if (arg == "--kalman")
+        {
+            settings.kalman = true;
+        } else if (arg == "--kalman-q" && has_value)
+        {
+            settings.kalman_q = std::stod(argv[++i]);
+        } else if (arg == "--kalman-r" && has_value)
+        {
+            settings.kalman_r = std::stod(argv[++i]);
+        } else if (arg == "--track")
+        {
+            settings.track = true;
+        } else if (arg == "--preview" && has_value)
+        {
+            settings.preview_step = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--preview-scale" && has_value)
+        {
+            settings.preview_scale = std::stod(argv[++i]);
+            if (!(settings.preview_scale > 0 && settings.preview_scale <= 1))
+            {
+                std::cerr << "/// --preview-scale must be in (0, 1]" << std::endl;
+                return false;
+            }
+        } else if (arg == "--skip-static" && has_value)
+        {
+            settings.skip_static = std::stod(argv[++i]);
+        } else
+        {
+            std::cerr << "/// Unknown or incomplete option      :       " << arg << "\n"
+                      << "Usage: mig_ncc_testing [--images <path>] [--threads <n>] [--threading auto|outer|inner] [--pin] [--prefetch <k>] [--io-threads <n>] [--pack] [--png-8bit] [--xlsx] [--sweep <file>] [--cache] [--search-margin <px>] [--mig-window] [--auto-roi] [--auto-roi-center <f>] [--consistency] [--consistency-tolerance <px>] [--kalman] [--kalman-q <q>] [--kalman-r <r>] [--track] [--preview <n>] [--preview-scale <s>] [--skip-static <t>] [--perf-counters] [--memory-stats] [--bench-threading] [--make-synthetic <path>] [--verify] [--bench <json>] [--bench-compare <baseline json> <json>]"
+                      << std::endl;
+            return false;
+        }
+    }
+
+    if (settings.num_workers == 0)
+    {
+        settings.num_workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (!(settings.kalman_q > 0 && settings.kalman_r > 0))
+    {
+        std::cerr << "/// --kalman-q and --kalman-r must be positive" << std::endl;
+        return false;
+    }
+
+    /* Tracking searches around the prediction, so it needs a margin */
+    if (settings.track && settings.search_margin < 0)
+    {
+        settings.search_margin = 16;
+    }
+    return true;
+}
+
+bool read_sweep(const std::string &path, std::vector<RoiConfig> &configs)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "/// Could not open sweep file         :       " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#')
+        {
+            continue;
+        }
+        std::istringstream fields(line);
+        RoiConfig config;
+        if (!(fields >> config.x >> config.y >> config.w >> config.h) || config.x < 0 || config.y < 0 || config.w <= 0 || config.h <= 0)
+        {
+            std::cerr << "/// Invalid RoI configuration         :       " << line << std::endl;
+            return false;
+        }
+        configs.push_back(config);
+    }
+
+    if (configs.empty())
+    {
+        std::cerr << "/// No RoI configuration in           :       " << path << std::endl;
+        return false;
+    }
+    std::cout << "/// RoI configurations in sweep       :       " << configs.size() << std::endl;
+    return true;
+}
+
+std::string RoiConfig::label() const
+{
+    return std::to_string(x) + "_" + std::to_string(y) + "_" + std::to_string(w) + "x" + std::to_string(h);
+}
+
+cv::Point RoiConfig::tl() const
+{
+    return cv::Point(x, y);
+}
+
+/* Folder where Results.csv of every experiment and the summary of the run are saved */
+const std::string results_dir = "../laser_decorrelation_results";
+
+/* Serializes console output of the workers */
+static std::mutex log_mutex;
+
+/* Number of frames per chunk. Experiments larger than this are split so that idle workers can steal parts of them.
+   Lowered in main() when a batch has fewer chunks than workers, so that every worker gets some. */
+static size_t chunk_frames = 64;
+
+/* Frames per core from which Outer beats Inner, Auto picks the policy by it. --bench-threading times the kernels of
+   process_chunk() with both policies and prints the crossover to put here. Inner only spreads matchTemplate over the
+   cores, the fused MIG kernel and the peak scan run on one thread either way, so Outer wins as soon as every core
+   has a frame of its own. */
+const double outer_frames_per_core = 1.0;
+
+/* Transformation Matrix Parameters */
+const double Txx = -256.75;
+const double Txy = 2.5;
+const double Tyx = 3.5;
+const double Tyy = 260.5;
+
+/* Constants for NCC */
+const int roi_w = 128, roi_h = 128, topLeft_x = 300, topLeft_y = 208, frameWidth = 728, frameHeight = 544;
+
+/* Synthetic experiment (--make-synthetic, --verify): number of frames and movement of the speckle per frame in pixels */
+const int synthetic_frames = 48, synthetic_step_col = 1, synthetic_step_row = -1;
+
+int recursive_folders(const std::string &root_path)
+{
+    /* Checking whether 'image' directory is present. */
+    if (!std::filesystem::exists(root_path))
+    {
+        std::cout << "The 'images' directory does not exist inside this project's directory.\n"
+                  << "Please copy it from the project: 'img_acq_testing'.\n"
+                  << std::endl;
+        return EXIT_FAILURE;
+    } else
+    {
+        std::cout << "/// Directory 'images' found." << std::endl;
+    }
+
+    /* All experiments of the batch, collected before any frame is processed */
+    std::vector<std::unique_ptr<Experiment>> experiments;
+
+    /* RoI configurations evaluated on every experiment */
+    const std::vector<RoiConfig> configs = settings.sweep.empty() ? std::vector<RoiConfig>{{topLeft_x, topLeft_y, roi_w, roi_h}} : settings.sweep;
+
+    /* Iterating through the 'images' folder */
+    for (const auto &cam_param_entry: std::filesystem::directory_iterator(root_path))
+    {
+        if (cam_param_entry.is_directory())
+        {
+            std::string cam_param_dir = cam_param_entry.path();
+            std::cout << "/// Inside Camera Param Directory     :       " << cam_param_dir << std::endl;
+
+            for (const auto &movement_entry: std::filesystem::directory_iterator(cam_param_dir))
+            {
+                if (movement_entry.is_directory())
+                {
+                    std::string movement_dir = movement_entry.path();
+                    std::cout << "/// Inside Movement Directory         :       " << movement_dir << std::endl;
+
+                    /* Ground truth for the error columns */
+                    MovementTruth truth = read_movement(movement_dir);
+                    if (!truth.valid)
+                    {
+                        std::cout << "/// No movement.txt, error columns stay empty" << std::endl;
+                    }
+
+                    for (const auto &exp_entry: std::filesystem::directory_iterator(movement_dir))
+                    {
+                        if (exp_entry.is_directory())
+                        {
+                            std::string exp_dir = exp_entry.path();
+                            std::cout << "/// Inside Experiment Directory       :       " << exp_dir << std::endl;
+
+                            /* Creating folders at this path */
+                            create_folders(results_dir + "/" + cam_param_entry.path().filename().string() + "/" + movement_entry.path().filename().string() + "/" + exp_entry.path().filename().string());
+
+                            auto exp = std::make_unique<Experiment>();
+                            exp->exp_dir = exp_dir;
+                            exp->gain_name = cam_param_entry.path().filename().string();
+                            exp->move_name = movement_entry.path().filename().string();
+                            exp->exp_name = exp_entry.path().filename().string();
+                            exp->truth = truth;
+
+                            /* Creating folders to save NCC images */
+                            exp->ncc_dir = "../laser_decorrelation_images_ncc/" + cam_param_entry.path().filename().string() + "/" + movement_entry.path().filename().string() + "/" + exp_entry.path().filename().string();
+                            create_folders(exp->ncc_dir);
+
+                            /* Folder of the csv files */
+                            std::string csv_dir = results_dir + "/" + cam_param_entry.path().filename().string() + "/" + movement_entry.path().filename().string() + "/" + exp_entry.path().filename().string();
+
+                            /* Declaring an empty string vector to store frame names */
+                            std::vector<std::string> file_names;
+
+                            /* Storing filenames inside the vector */
+                            for (const auto &img_entry:std::filesystem::directory_iterator(exp_dir))
+                            {
+                                if (img_entry.path().extension() == ".png" || img_entry.path().extension() == ".raw")
+                                {
+                                    file_names.push_back(img_entry.path().filename().string());
+                                }
+                            }
+
+                            /* Sorting filenames */
+                            std::sort(file_names.begin(), file_names.end(), [](const std::string &a, const std::string &b)
+                            {
+                                std::string num_a = a.substr(a.find_first_of("0123456789"));
+                                std::string num_b = b.substr(b.find_first_of("0123456789"));
+                                int int_a = std::stoi(num_a);
+                                int int_b = std::stoi(num_b);
+                                return int_a < int_b;
+                            });
+
+                            /* Packing the frames into a single container, if requested */
+                            std::string pack_path = exp_dir + "/frames.pack";
+                            if (settings.pack_frames && !file_names.empty() && !std::filesystem::exists(pack_path))
+                            {
+                                std::vector<std::string> frame_paths;
+                                for (const auto &file_name: file_names)
+                                {
+                                    frame_paths.push_back(exp_dir + "/" + file_name);
+                                }
+                                if (!write_frame_pack(pack_path, frame_paths))
+                                {
+                                    std::cerr << "/// Error writing frame container     :       " << pack_path << std::endl;
+                                }
+                            }
+
+                            exp->source = open_frame_source(exp_dir, file_names);
+                            std::cout << "/// Reading frames from               :       " << exp->source->describe() << std::endl;
+                            cv::Mat frame_0 = exp->source->first_frame();
+
+                            /* Texture of frame_0 for placing the RoIs automatically */
+                            cv::Mat energy_integral;
+                            if (settings.auto_roi && !frame_0.empty())
+                            {
+                                energy_integral = texture_integral(frame_0);
+                            }
+
+                            /* One RoI, spectrum and csv file per RoI configuration */
+                            for (const RoiConfig &config: configs)
+                            {
+                                Experiment::RoiOutput output;
+                                output.config = config;
+                                if (!energy_integral.empty() && config.w <= frame_0.cols && config.h <= frame_0.rows)
+                                {
+                                    cv::Point corner = place_roi(energy_integral, config.w, config.h, settings.auto_roi_center);
+                                    output.config.x = corner.x;
+                                    output.config.y = corner.y;
+                                    std::cout << "/// RoI placed at                     :       " << output.config.label() << std::endl;
+                                }
+
+                                const RoiConfig &placed = output.config;
+                                if (frame_0.empty() || placed.x + placed.w > frame_0.cols || placed.y + placed.h > frame_0.rows)
+                                {
+                                    std::cerr << "/// RoI outside of frame_0            :       " << placed.label() << " in " << exp_dir << std::endl;
+                                    return EXIT_FAILURE;
+                                }
+
+                                /* Getting ROI for the experiment folder */
+                                output.roi = get_roi(frame_0, placed.w, placed.h, placed.x, placed.y);
+                                if (output.roi.depth() != CV_8U)
+                                {
+                                    output.roi.convertTo(output.roi_f, CV_32F);
+                                }
+                                output.window = search_window(placed, frame_0.size());
+                                exp->active = exp->active.empty() ? output.window : (exp->active | output.window);
+
+                                /* The csv file is created by the writer when the first chunk is written */
+                                output.csv_path = csv_dir + "/" + (settings.sweep.empty() ? "Results.csv" : "Results_" + config.label() + ".csv");
+                                exp->outputs.push_back(std::move(output));
+                            }
+
+                            /* Hardware counters per frame and stage */
+                            if (settings.perf_counters)
+                            {
+                                exp->perf_path = csv_dir + "/Counters.csv";
+                            }
+
+                            /* With the MIG restricted to the search windows, no frame row below them is ever used. Tracked
+                               windows move, so their rows are limited per chunk (see track_chunk()). */
+                            exp->frame_size = frame_0.size();
+                            exp->row_limit = (settings.mig_window && !settings.track) ? exp->active.br().y : frame_0.rows;
+                            if (exp->row_limit < frame_0.rows)
+                            {
+                                std::cout << "/// Rows decoded per frame            :       " << exp->row_limit << " of " << frame_0.rows << std::endl;
+                            }
+                            if (settings.consistency)
+                            {
+                                frame_spectrum(frame_0, exp->reference);
+                            }
+                            if (!settings.sweep.empty())
+                            {
+                                cv::Mat1f padded;
+                                for (auto &output: exp->outputs)
+                                {
+                                    template_spectrum(output.roi, cv::Size(frame_0.cols, exp->row_limit), padded, output.spectrum);
+                                }
+                            }
+
+                            /* Loading what earlier runs computed for these frames */
+                            if (settings.cache)
+                            {
+                                std::string cache_path = csv_dir + "/FrameCache.bin";
+                                if (!open_frame_cache(cache_path, exp->cache))
+                                {
+                                    std::cerr << "/// Error opening frame cache         :       " << cache_path << std::endl;
+                                    return EXIT_FAILURE;
+                                }
+                                std::cout << "/// Frame cache entries               :       " << exp->cache.mig.size() << std::endl;
+                            }
+
+                            experiments.push_back(std::move(exp));
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /***** MIG and NCC Start *****/
+
+    /* Largest experiments are queued first, so that their chunks are spread over all workers */
+    std::sort(experiments.begin(), experiments.end(), [](const std::unique_ptr<Experiment> &a, const std::unique_ptr<Experiment> &b)
+    {
+        return a->source->frame_count() > b->source->frame_count();
+    });
+
+    /* Frames the workers can share: those of random access sources, a stream is read by one worker */
+    size_t shared_frames = 0;
+    for (const auto &exp: experiments)
+    {
+        shared_frames += exp->source->random_access() ? exp->source->frame_count() : 1;
+    }
+
+    WorkStealingScheduler scheduler(apply_threading_policy(settings.threading, shared_frames));
+    if (scheduler.size() > 1 && shared_frames < chunk_frames * scheduler.size())
+    {
+        /* Fewer chunks than workers, smaller chunks keep all of them busy */
+        chunk_frames = std::max<size_t>(1, (shared_frames + scheduler.size() - 1) / scheduler.size());
+        std::cout << "/// Frames per chunk                  :       " << chunk_frames << std::endl;
+    }
+    if (scheduler.size() > 1)
+    {
+        std::cout << "/// Threading policy                  :       outer (" << scheduler.size() << " workers, OpenCV single threaded)" << std::endl;
+    } else
+    {
+        std::cout << "/// Threading policy                  :       inner (1 worker, OpenCV with " << settings.num_workers << " threads)" << std::endl;
+    }
+    if (settings.pin_workers)
+    {
+        place_workers(scheduler);
+    }
+
+    /* Buffers of every worker, created lazily on the worker's own thread so that their pages are local to it */
+    std::vector<std::unique_ptr<FrameScratch>> scratches(scheduler.size());
+
+    /* An optional preview pass over every Nth frame at reduced resolution, then the full pass that overwrites it */
+    const bool preview = settings.preview_step > 0;
+    for (int pass = preview ? 0 : 1; pass < 2; pass++)
+    {
+        const size_t step = pass == 0 ? settings.preview_step : 1;
+        const double scale = pass == 0 ? settings.preview_scale : 1.0;
+
+        size_t total_frames = 0;
+        for (const auto &exp: experiments)
+        {
+            if (pass == 1 && preview)
+            {
+                /* Starting the results over, the rows of the preview are provisional */
+                for (auto &output: exp->outputs)
+                {
+                    output.summary = ExperimentSummary();
+                    output.filter = ShiftFilter();
+                }
+                exp->busy_seconds = 0;
+                exp->next_chunk = 0;
+                exp->next_frame = 0;
+                exp->perf = StagePerf();
+                exp->perf_frames = 0;
+            }
+            if (pass == 0)
+            {
+                /* Streams can only be read once, they get the full pass only */
+                if (!exp->source->random_access())
+                {
+                    continue;
+                }
+                for (auto &output: exp->outputs)
+                {
+                    cv::resize(output.roi, output.preview_roi, cv::Size(), scale, scale, cv::INTER_AREA);
+                }
+            }
+
+            size_t num_chunks = chunk_count(*exp);
+            exp->chunk_rows.assign(num_chunks, std::vector<FrameRow>());
+            exp->chunk_done.assign(num_chunks, false);
+            if (!exp->source->random_access())
+            {
+                /* Streams are read until they end */
+                scheduler.submit({exp.get(), 0, 0, std::numeric_limits<size_t>::max(), step, scale, pass == 1});
+            } else
+            {
+                for (size_t c = 0; c < num_chunks; c++)
+                {
+                    size_t begin = c * chunk_frames;
+                    scheduler.submit({exp.get(), c, begin, std::min(begin + chunk_frames, exp->source->frame_count()), step, scale, pass == 1});
+                }
+            }
+            total_frames += (exp->source->frame_count() + step - 1) / step;
+        }
+
+        if (pass == 0)
+        {
+            std::cout << "/// Preview of " << total_frames << " frames (every " << step << ". frame, scaled by " << scale << ") of " << experiments.size() << " experiments on " << scheduler.size() << " workers" << std::endl;
+        } else
+        {
+            std::cout << "/// Processing " << total_frames << " frames of " << experiments.size() << " experiments on " << scheduler.size() << " workers" << std::endl;
+        }
+
+        scheduler.run([&scratches](const FrameChunk &chunk, unsigned worker_id)
+        {
+            if (!scratches[worker_id])
+            {
+                scratches[worker_id] = std::make_unique<FrameScratch>();
+            } else if (scratches[worker_id]->perf_thread != std::this_thread::get_id())
+            {
+                /* Every pass runs on new threads, the counters of the last pass would not see this one */
+                scratches[worker_id]->open_perf_counters();
+            }
+            process_chunk(chunk, *scratches[worker_id]);
+        });
+
+        /* The writers closed the files of every experiment after its last chunk */
+        for (const auto &exp: experiments)
+        {
+            if (exp->write_failed)
+            {
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (write_summary(experiments) != EXIT_SUCCESS || write_report(experiments) != EXIT_SUCCESS)
+        {
+            return EXIT_FAILURE;
+        }
+        if (pass == 0)
+        {
+            std::cout << "/// Provisional results written, refining at full frame rate and resolution" << std::endl;
+        }
+    }
+
+    /***** MIG and NCC End *****/
+
+    return settings.memory_stats ? write_memory_report() : EXIT_SUCCESS;
+}
+
+void process_chunk(const FrameChunk &chunk, FrameScratch &scratch)
+{
+    Experiment &exp = *chunk.exp;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<FrameRow> rows;
+    {
+        /* The rows are handed to the writer */
+        MemoryScope writer_scope(MemoryStage::Writer);
+        rows.reserve(std::min(chunk.end - chunk.begin, chunk_frames) * exp.outputs.size());
+    }
+
+    /* The preview reads every step-th frame of the experiment, the first of them in this chunk */
+    const size_t first_index = (chunk.begin + chunk.step - 1) / chunk.step * chunk.step;
+
+    /* Predictors of the search windows in tracking mode, continued from the filters of the writer. The part of the
+       frame they can reach in this chunk replaces the fixed one of the experiment. */
+    std::vector<ShiftFilter> trackers;
+    cv::Rect active = exp.active;
+    int row_limit = exp.row_limit;
+    if (settings.track && chunk.scale == 1.0)
+    {
+        active = track_chunk(exp, first_index, chunk.end, trackers);
+
+        /* The spectra of a sweep are sized for exp.row_limit */
+        if (settings.mig_window && settings.sweep.empty())
+        {
+            row_limit = active.br().y;
+        }
+    }
+
+    /* Samples of the last processed frame of the chunk and of the current frame, for --skip-static */
+    std::vector<float> previous_grid, change_grid;
+
+    /* Hardware counters of this worker, all 0 without --perf-counters */
+    auto counters = [&scratch]() { return scratch.perf ? scratch.perf->read() : PerfSample(); };
+    for (const FrameView &view: exp.source->range(first_index, chunk.end, chunk.step, scratch))
+    {
+        {
+            std::lock_guard<std::mutex> lock(log_mutex);
+            std::cout << "/// Reading image                     :       " << exp.source->frame_name(view.index) << std::endl;
+        }
+        // Getting the image from the frame source, decoded into the buffers of this worker if necessary
+        StagePerf frame_perf;
+        PerfSample perf_start = counters();
+        cv::Mat img;
+        {
+            MemoryScope decode_scope(MemoryStage::Decode);
+            img = decode_frame(view, row_limit, scratch);
+        }
+        frame_perf.decode = counters() - perf_start;
+        if (settings.memory_stats)
+        {
+            memory_frames.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (chunk.scale != 1.0)
+        {
+            preview_frame(exp, view.index, img, chunk.scale, scratch, rows);
+            continue;
+        }
+        const cv::Rect frame_rect(0, 0, img.cols, img.rows);
+
+        /* A frame that barely changed since the last processed one repeats its rows. It is compared with the last
+           processed frame rather than the previous one, so that a slow drift is not skipped frame after frame. */
+        if (settings.skip_static >= 0)
+        {
+            double change = img.empty() ? std::numeric_limits<double>::infinity() : frame_change(img, view.significant_bits(img), active & frame_rect, change_grid, previous_grid);
+            if (change <= settings.skip_static)
+            {
+                size_t first = rows.size() - exp.outputs.size();
+                for (size_t c = 0; c < exp.outputs.size(); c++)
+                {
+                    FrameRow row = rows[first + c];
+                    row.index = view.index;
+                    row.skipped = true;
+                    row.perf = StagePerf();
+                    row.perf.decode = c == 0 ? frame_perf.decode : PerfSample();
+                    row.cache_key = 0;
+                    row.cached = false;
+                    if (settings.track && row.ncc.confidence > 0)
+                    {
+                        trackers[c].update(row.ncc.shift_col, row.ncc.shift_row, settings.kalman_q, settings.kalman_r);
+                    } else if (settings.track)
+                    {
+                        trackers[c].coast(settings.kalman_q);
+                    }
+                    rows.push_back(row);
+                }
+                continue;
+            }
+            if (img.empty())
+            {
+                previous_grid.clear();
+            } else
+            {
+                std::swap(previous_grid, change_grid);
+            }
+        }
+
+        /* MIG of the whole frame, or with --mig-window of the part that contains the search windows */
+        cv::Mat mig_input = (settings.mig_window && !img.empty()) ? img(active & frame_rect) : img;
+
+        /* MIG and, in sweep mode, the spectrum of the frame are shared by all RoI configurations */
+        uint64_t cache_key = 0;
+        bool cached = false;
+        double mig = 0;
+        perf_start = counters();
+        {
+            MemoryScope mig_scope(MemoryStage::Mig);
+            if (settings.cache && !img.empty())
+            {
+                cache_key = frame_cache_key(mig_input);
+                auto entry = exp.cache.mig.find(cache_key);
+                if (entry != exp.cache.mig.end())
+                {
+                    mig = entry->second;
+                    cached = true;
+                }
+            }
+            if (!cached)
+            {
+                /* An unreadable frame has no MIG */
+                mig = img.empty() ? std::numeric_limits<double>::quiet_NaN() : mig_frame(mig_input, scratch);
+            }
+        }
+        frame_perf.mig = counters() - perf_start;
+        bool sweep = !settings.sweep.empty();
+        perf_start = counters();
+        if (sweep && !img.empty())
+        {
+            MemoryScope ncc_scope(MemoryStage::Ncc);
+            frame_spectrum(img, scratch.spectrum);
+        }
+        frame_perf.ncc = counters() - perf_start;
+
+        for (size_t c = 0; c < exp.outputs.size(); c++)
+        {
+            MemoryScope ncc_scope(MemoryStage::Ncc);
+            const Experiment::RoiOutput &output = exp.outputs[c];
+            FrameRow row;
+            row.index = view.index;
+            row.mismatch = std::numeric_limits<double>::quiet_NaN();
+            row.skipped = false;
+            row.perf = c == 0 ? frame_perf : StagePerf();
+            perf_start = counters();
+            cv::Rect window = (settings.track ? tracking_window(output.config, trackers[c], img.size()) & active : output.window) & frame_rect;
+            bool matched = window.width >= output.config.w && window.height >= output.config.h;
+            if (!matched)
+            {
+                row.ncc = LocAndConf();
+            } else if (sweep)
+            {
+                row.ncc = match_spectral(scratch.spectrum, output.spectrum, output.config.w, output.config.h, window, output.config.tl(), scratch);
+            } else
+            {
+                /* Matching within the search window only, then moving the match back into frame coordinates */
+                row.ncc = get_results(img(window), output.roi_f.empty() ? output.roi : output.roi_f, output.config.tl() - window.tl(), scratch);
+                row.ncc.match_loc += window.tl();
+            }
+            if (matched && settings.consistency)
+            {
+                row.mismatch = forward_backward_consistent(img, row.ncc, exp, output, scratch) ? 0.0 : 1.0;
+            }
+            row.perf.ncc += counters() - perf_start;
+
+            /* Same rule as the writer's filter, so that both agree on every frame */
+            if (settings.track && row.ncc.confidence > 0)
+            {
+                trackers[c].update(row.ncc.shift_col, row.ncc.shift_row, settings.kalman_q, settings.kalman_r);
+            } else if (settings.track)
+            {
+                trackers[c].coast(settings.kalman_q);
+            }
+            row.mig = mig;
+            row.cache_key = cache_key;
+            row.cached = cached;
+
+            // Uncomment the following when trying to save ncc images
+            // cv::rectangle(img, row.ncc.match_loc, cv::Point(row.ncc.match_loc.x + roi_w, row.ncc.match_loc.y + roi_h), cv::Scalar(0), 3);
+
+            // cv::putText(img, "Confidence: " + std::to_string(static_cast<int>(std::round(row.ncc.confidence))) + "%", cv::Point(10, 40), cv::FONT_HERSHEY_SIMPLEX, 1.5, cv::Scalar(0), 3);
+
+            // cv::imwrite(exp.ncc_dir + "/frame_" + std::to_string(view.index) + ".png", img);
+
+            rows.push_back(row);
+        }
+    }
+
+    fill_distances(rows, exp.truth, scratch.columns);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    commit_chunk(chunk, std::move(rows), elapsed.count());
+}
+
+void preview_frame(const Experiment &exp, size_t index, const cv::Mat &img, double scale, FrameScratch &scratch, std::vector<FrameRow> &rows)
+{
+    cv::Mat small;
+    if (!img.empty())
+    {
+        cv::resize(img, scratch.preview, cv::Size(), scale, scale, cv::INTER_AREA);
+        small = scratch.preview;
+    }
+    double mig = small.empty() ? std::numeric_limits<double>::quiet_NaN() : mig_frame(small, scratch);
+    const cv::Rect small_rect(0, 0, small.cols, small.rows);
+
+    for (const auto &output: exp.outputs)
+    {
+        FrameRow row;
+        row.index = index;
+        row.mig = mig;
+        row.cache_key = 0;
+        row.cached = false;
+        row.mismatch = std::numeric_limits<double>::quiet_NaN();
+        row.skipped = false;
+        row.perf = StagePerf();
+
+        const cv::Mat &roi = output.preview_roi;
+        const cv::Rect &window = output.window;
+        cv::Rect small_window = cv::Rect(cvRound(window.x * scale), cvRound(window.y * scale), cvRound(window.width * scale), cvRound(window.height * scale)) & small_rect;
+        if (small.empty() || small_window.width < roi.cols || small_window.height < roi.rows)
+        {
+            row.ncc = LocAndConf();
+        } else
+        {
+            row.ncc = get_results(small(small_window), roi, cv::Point(), scratch);
+
+            /* Match back in full resolution pixels, then the shift from the RoI like get_results() computes it */
+            cv::Point loc = row.ncc.match_loc + small_window.tl();
+            row.ncc.match_loc = cv::Point(cvRound(loc.x / scale), cvRound(loc.y / scale));
+            row.ncc.shift_row = row.ncc.match_loc.y - output.config.y;
+            row.ncc.shift_col = row.ncc.match_loc.x - output.config.x;
+        }
+        rows.push_back(row);
+    }
+}
+
+bool open_results(Experiment::RoiOutput &output)
+{
+    output.csv_file.open(output.csv_path, std::ios::out | std::ios::trunc);
+    if (!output.csv_file.is_open())
+    {
+        return false;
+    }
+
+    /* Adding first row to the .csv file */
+    output.csv_file << "Pixel Shift X (Columns),Pixel Shift Y (Rows),Confidence (%),Dist. X (mm),Dist. Y (mm),Error X (mm),Error Y (mm),Error X (%),Error Y (%),MIG,PSR,Peak Ratio"
+                    << (settings.kalman ? ",Filtered Shift X,Filtered Shift Y,Innovation" : "")
+                    << (settings.consistency ? ",FB Mismatch" : "")
+                    << (settings.skip_static >= 0 ? ",Skipped" : "") << std::endl;
+    return true;
+}
+
+bool open_counters(Experiment &exp)
+{
+    exp.perf_file.open(exp.perf_path, std::ios::out | std::ios::trunc);
+    if (!exp.perf_file.is_open())
+    {
+        return false;
+    }
+
+    exp.perf_file << "Frame";
+    for (const char *stage: {"Decode", "MIG", "NCC"})
+    {
+        exp.perf_file << "," << stage << " Cycles," << stage << " Instructions," << stage << " LLC Misses," << stage << " Branch Misses";
+    }
+    exp.perf_file << std::endl;
+    return true;
+}
+
+bool open_outputs(Experiment &exp)
+{
+    bool opened = true;
+    for (auto &output: exp.outputs)
+    {
+        opened = opened && open_results(output);
+
+        /* A sweep writes one file per configuration, they are reopened for every chunk (see commit_chunk()) */
+        if (!settings.sweep.empty())
+        {
+            output.csv_file.close();
+        }
+    }
+    if (!exp.perf_path.empty())
+    {
+        opened = opened && open_counters(exp);
+    }
+    if (!exp.cache.path.empty())
+    {
+        exp.cache.file.open(exp.cache.path, std::ios::binary | std::ios::app);
+        opened = opened && exp.cache.file.is_open();
+    }
+    if (!opened)
+    {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        std::cerr << "Error opening the .csv file!!!" <<std::endl;
+        exp.write_failed = true;
+    }
+    return opened;
+}
+
+void close_outputs(Experiment &exp)
+{
+    for (auto &output: exp.outputs)
+    {
+        output.csv_file.close();
+    }
+    exp.perf_file.close();
+    exp.cache.file.close();
+}
+
+size_t chunk_count(const Experiment &exp)
+{
+    if (!exp.source->random_access())
+    {
+        return 1;
+    }
+    return (exp.source->frame_count() + chunk_frames - 1) / chunk_frames;
+}
+
+void commit_chunk(const FrameChunk &chunk, std::vector<FrameRow> &&rows, double busy_seconds)
+{
+    MemoryScope writer_scope(MemoryStage::Writer);
+    Experiment &exp = *chunk.exp;
+    std::lock_guard<std::mutex> lock(exp.write_mutex);
+    exp.busy_seconds += busy_seconds;
+    exp.chunk_rows[chunk.chunk_id] = std::move(rows);
+    exp.chunk_done[chunk.chunk_id] = true;
+
+    /* The files of an experiment are only opened once its first chunk is written */
+    if (exp.next_chunk == 0 && exp.chunk_done[0] && !open_outputs(exp))
+    {
+        close_outputs(exp);
+        exp.next_chunk = exp.chunk_done.size();
+    }
+
+    /* Writing every chunk that is now complete and next in frame order */
+    while (exp.next_chunk < exp.chunk_done.size() && exp.chunk_done[exp.next_chunk])
+    {
+        const std::vector<FrameRow> &chunk_rows = exp.chunk_rows[exp.next_chunk];
+        const size_t num_outputs = exp.outputs.size();
+        for (size_t c = 0; c < num_outputs; c++)
+        {
+            /* In sweep mode only the file of the configuration being written is open */
+            Experiment::RoiOutput &output = exp.outputs[c];
+            const bool reopen = !output.csv_file.is_open();
+            if (reopen)
+            {
+                output.csv_file.open(output.csv_path, std::ios::out | std::ios::app);
+            }
+            if (!output.csv_file.is_open() && !exp.write_failed)
+            {
+                std::lock_guard<std::mutex> log_lock(log_mutex);
+                std::cerr << "Error opening the .csv file!!!" <<std::endl;
+                exp.write_failed = true;
+            }
+
+            for (size_t k = c; k < chunk_rows.size(); k += num_outputs)
+            {
+                const FrameRow &row = chunk_rows[k];
+
+                /* Empty cell for values that are not available */
+                auto cell = [](double value) { return CsvCell{value}; };
+
+                // // Uncomment following during calibration
+                // output.csv_file << row.ncc.shift_col << ","
+                //              << row.ncc.shift_row << ","
+                //              << row.ncc.confidence << ","
+                //              << ",,,,,,"
+                //              << row.mig
+                //              << std::endl;
+
+                /* Frames that were not matched are only counted, their shift of 0 is not a measurement */
+                if (row.ncc.confidence > 0)
+                {
+                    output.summary.shift_x.add(row.ncc.shift_col);
+                    output.summary.shift_y.add(row.ncc.shift_row);
+                    output.summary.confidence.add(row.ncc.confidence);
+                    output.summary.dist_x.add(row.dist_x);
+                    output.summary.dist_y.add(row.dist_y);
+                } else
+                {
+                    output.summary.unmatched++;
+                }
+                output.summary.frames++;
+                if (!std::isnan(row.mig))
+                {
+                    output.summary.mig.add(row.mig);
+                }
+                if (!std::isnan(row.ncc.psr))
+                {
+                    output.summary.psr.add(row.ncc.psr);
+                }
+                if (!std::isnan(row.ncc.peak_ratio))
+                {
+                    output.summary.peak_ratio.add(row.ncc.peak_ratio);
+                }
+                output.summary.mismatches += row.mismatch == 1.0;
+                output.summary.skipped += row.skipped;
+                if (!std::isnan(row.error_x))
+                {
+                    output.summary.error_x.add(row.error_x);
+                    output.summary.error_y.add(row.error_y);
+                }
+
+                // Uncomment following during testing
+                output.csv_file << row.ncc.shift_col << ","
+                             << row.ncc.shift_row << ","
+                             << row.ncc.confidence << ","
+                             << row.dist_x << ","
+                             << row.dist_y << ","
+                             << cell(row.error_x) << ","
+                             << cell(row.error_y) << ","
+                             << cell(row.error_x_pct) << ","
+                             << cell(row.error_y_pct) << ","
+                             << cell(row.mig) << ","
+                             << cell(row.ncc.psr) << ","
+                             << cell(row.ncc.peak_ratio);
+                /* Filtered in frame order, unmatched frames only advance the filter. Tracking continues from it. */
+                ShiftFilter &filter = output.filter;
+                double innovation = std::numeric_limits<double>::quiet_NaN();
+                if ((settings.kalman || settings.track) && row.ncc.confidence > 0)
+                {
+                    innovation = filter.update(row.ncc.shift_col, row.ncc.shift_row, settings.kalman_q, settings.kalman_r);
+                } else if (settings.kalman || settings.track)
+                {
+                    filter.coast(settings.kalman_q);
+                }
+                if (settings.kalman)
+                {
+                    output.csv_file << "," << cell(filter.started ? filter.x.p : std::numeric_limits<double>::quiet_NaN())
+                                    << "," << cell(filter.started ? filter.y.p : std::numeric_limits<double>::quiet_NaN())
+                                    << "," << cell(innovation);
+                }
+                if (settings.consistency)
+                {
+                    output.csv_file << "," << cell(row.mismatch);
+                }
+                if (settings.skip_static >= 0)
+                {
+                    output.csv_file << "," << row.skipped;
+                }
+                output.csv_file << "\n";
+            }
+            if (reopen)
+            {
+                output.csv_file.close();
+            }
+        }
+
+        /* Hardware counters per frame, NCC summed over the RoI configurations */
+        if (exp.perf_file.is_open())
+        {
+            for (size_t k = 0; k < chunk_rows.size(); k += exp.outputs.size())
+            {
+                StagePerf frame_perf = chunk_rows[k].perf;
+                for (size_t c = 1; c < exp.outputs.size(); c++)
+                {
+                    frame_perf.ncc += chunk_rows[k + c].perf.ncc;
+                }
+                exp.perf += frame_perf;
+                exp.perf_frames++;
+
+                exp.perf_file << chunk_rows[k].index;
+                for (const PerfSample *stage: {&frame_perf.decode, &frame_perf.mig, &frame_perf.ncc})
+                {
+                    exp.perf_file << "," << stage->cycles << "," << stage->instructions << "," << stage->llc_misses << "," << stage->branch_misses;
+                }
+                exp.perf_file << "\n";
+            }
+        }
+
+        /* New frame cache entries, once per frame (the first RoI configuration) */
+        if (exp.cache.file.is_open())
+        {
+            for (size_t k = 0; k < chunk_rows.size(); k += exp.outputs.size())
+            {
+                const FrameRow &row = chunk_rows[k];
+                if (row.cache_key != 0 && !row.cached)
+                {
+                    exp.cache.file.write(reinterpret_cast<const char *>(&row.cache_key), sizeof(row.cache_key));
+                    exp.cache.file.write(reinterpret_cast<const char *>(&row.mig), sizeof(row.mig));
+                }
+            }
+        }
+
+        /* Rows are not needed anymore once written */
+        if (!chunk_rows.empty())
+        {
+            exp.next_frame = chunk_rows.back().index + 1;
+        }
+        std::vector<FrameRow>().swap(exp.chunk_rows[exp.next_chunk]);
+        exp.next_chunk++;
+
+        /* After the last chunk nothing of this experiment is written or read anymore */
+        if (exp.next_chunk == exp.chunk_done.size())
+        {
+            close_outputs(exp);
+            if (chunk.last_pass)
+            {
+                exp.source->close();
+            }
+        }
+    }
+}
+
+unsigned apply_threading_policy(ThreadingPolicy policy, size_t num_frames)
+{
+    if (policy == ThreadingPolicy::Auto)
+    {
+        policy = (num_frames >= outer_frames_per_core * settings.num_workers) ? ThreadingPolicy::Outer : ThreadingPolicy::Inner;
+    }
+
+    /* OpenCV's thread pool is process wide, so it is configured once before the workers start */
+    if (policy == ThreadingPolicy::Outer)
+    {
+        cv::setNumThreads(1);
+        return settings.num_workers;
+    }
+
+    cv::setNumThreads(static_cast<int>(settings.num_workers));
+    return 1;
+}
+
+int run_threading_benchmark()
+{
+    /* Synthetic speckle frame, the template is taken from a shifted copy so that NCC has a real peak to find */
+    cv::Mat frame(frameHeight, frameWidth, CV_8UC1);
+    cv::randu(frame, cv::Scalar(0), cv::Scalar(255));
+    cv::GaussianBlur(frame, frame, cv::Size(5, 5), 1.5);
+    cv::Mat roi = get_roi(frame, roi_w, roi_h, topLeft_x + 7, topLeft_y - 5);
+    const cv::Point origin(topLeft_x, topLeft_y);
+
+    /* Buffers per worker as in the real run, kept across batches so that only the first batch allocates them */
+    std::vector<std::unique_ptr<FrameScratch>> scratches(settings.num_workers);
+
+    /* Times 'num_frames' frames with the given policy, returns frames per second. Every frame runs the kernels of
+       process_chunk(): the fused MIG and the NCC with its peak scan. */
+    auto measure = [&](ThreadingPolicy policy, size_t num_frames)
+    {
+        WorkStealingScheduler scheduler(apply_threading_policy(policy, num_frames));
+        for (size_t i = 0; i < num_frames; i++)
+        {
+            scheduler.submit({nullptr, i, i, i + 1});
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        scheduler.run([&](const FrameChunk &, unsigned worker_id)
+        {
+            if (!scratches[worker_id])
+            {
+                scratches[worker_id] = std::make_unique<FrameScratch>();
+            }
+            mig_frame(frame, *scratches[worker_id]);
+            get_results(frame, roi, origin, *scratches[worker_id]);
+        });
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return num_frames / elapsed.count();
+    };
+
+    std::cout << "/// Threading benchmark on " << settings.num_workers << " cores (frames/s)\n"
+              << "frames,outer,inner" << std::endl;
+
+    /* Not timed: allocates the buffers of every worker */
+    measure(ThreadingPolicy::Outer, settings.num_workers);
+
+    size_t crossover = 0;
+    for (size_t num_frames = 1; num_frames <= 8 * settings.num_workers; num_frames *= 2)
+    {
+        double outer = measure(ThreadingPolicy::Outer, num_frames);
+        double inner = measure(ThreadingPolicy::Inner, num_frames);
+        std::cout << num_frames << "," << outer << "," << inner << std::endl;
+        if (crossover == 0 && outer > inner)
+        {
+            crossover = num_frames;
+        }
+    }
+
+    if (crossover == 0)
+    {
+        std::cout << "/// Inner was faster for every batch size" << std::endl;
+    } else
+    {
+        std::cout << "/// Outer is faster from " << crossover << " frames (" << crossover / static_cast<double>(settings.num_workers) << " frames per core, outer_frames_per_core is " << outer_frames_per_core << ")" << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
+
+void ShiftFilter::Axis::predict(double q)
+{
+    /* x = F x, P = F P F' + Q with F = [1 1; 0 1] and Q = q [1/4 1/2; 1/2 1] */
+    p += v;
+    p00 += 2 * p01 + p11 + q / 4;
+    p01 += p11 + q / 2;
+    p11 += q;
+}
+
+double ShiftFilter::Axis::correct(double z, double r)
+{
+    double innovation = z - p;
+    double s = p00 + r;
+    double k0 = p00 / s, k1 = p01 / s;
+    p += k0 * innovation;
+    v += k1 * innovation;
+    p11 -= k1 * p01;
+    p01 *= 1 - k0;
+    p00 *= 1 - k0;
+    return innovation;
+}
+
+double ShiftFilter::update(double shift_x, double shift_y, double q, double r)
+{
+    if (!started)
+    {
+        /* First frame: position measured, velocity unknown */
+        for (Axis *axis: {&x, &y})
+        {
+            axis->v = 0;
+            axis->p00 = r;
+            axis->p01 = 0;
+            axis->p11 = r;
+        }
+        x.p = shift_x;
+        y.p = shift_y;
+        started = true;
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    x.predict(q);
+    y.predict(q);
+    return std::hypot(x.correct(shift_x, r), y.correct(shift_y, r));
+}
+
+void ShiftFilter::coast(double q)
+{
+    if (started)
+    {
+        x.predict(q);
+        y.predict(q);
+    }
+}
+
+void RunningStats::add(double value)
+{
+    count++;
+    double delta = value - mean;
+    mean += delta / count;
+    m2 += delta * (value - mean);
+    min = std::min(min, value);
+    max = std::max(max, value);
+}
+
+int write_summary(const std::vector<std::unique_ptr<Experiment>> &experiments)
+{
+    const char *quantities[] = {"Pixel Shift X (Columns)", "Pixel Shift Y (Rows)", "Confidence (%)", "Dist. X (mm)", "Dist. Y (mm)", "Error X (mm)", "Error Y (mm)", "MIG", "PSR", "Peak Ratio"};
+    const char *statistics[] = {"Mean", "Std", "Min", "Max"};
+
+    /* Experiments in the order of the folders, not in the order they were scheduled */
+    std::vector<const Experiment *> sorted;
+    for (const auto &exp: experiments)
+    {
+        sorted.push_back(exp.get());
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const Experiment *a, const Experiment *b)
+    {
+        if (a->gain_name != b->gain_name)
+        {
+            return natural_less(a->gain_name, b->gain_name);
+        }
+        if (a->move_name != b->move_name)
+        {
+            return natural_less(a->move_name, b->move_name);
+        }
+        return natural_less(a->exp_name, b->exp_name);
+    });
+
+    /* Header and rows as cells, shared by the .csv and the .xlsx */
+    std::vector<std::string> header = {"Gain", "Move", "Exp", "RoI X", "RoI Y", "RoI W", "RoI H", "Frames", "Unmatched Frames"};
+    for (const char *quantity: quantities)
+    {
+        for (const char *statistic: statistics)
+        {
+            header.push_back(std::string(quantity) + " " + statistic);
+        }
+    }
+    if (settings.consistency)
+    {
+        header.push_back("FB Mismatches");
+    }
+    if (settings.skip_static >= 0)
+    {
+        header.push_back("Skipped Frames");
+    }
+
+    /* One row per experiment and RoI configuration */
+    std::vector<const Experiment *> row_exps;
+    std::vector<std::vector<double>> values;
+    for (const Experiment *exp: sorted)
+    {
+        for (const auto &output: exp->outputs)
+        {
+            const RoiConfig &config = output.config;
+            const ExperimentSummary &summary = output.summary;
+            std::vector<double> row = {static_cast<double>(config.x), static_cast<double>(config.y), static_cast<double>(config.w), static_cast<double>(config.h), static_cast<double>(summary.frames), static_cast<double>(summary.unmatched)};
+            for (const RunningStats *stats: {&summary.shift_x, &summary.shift_y, &summary.confidence, &summary.dist_x, &summary.dist_y, &summary.error_x, &summary.error_y, &summary.mig, &summary.psr, &summary.peak_ratio})
+            {
+                if (stats->count == 0)
+                {
+                    row.insert(row.end(), 4, std::numeric_limits<double>::quiet_NaN());
+                } else
+                {
+                    row.insert(row.end(), {stats->mean, stats->stddev(), stats->min, stats->max});
+                }
+            }
+            if (settings.consistency)
+            {
+                row.push_back(static_cast<double>(summary.mismatches));
+            }
+            if (settings.skip_static >= 0)
+            {
+                row.push_back(static_cast<double>(summary.skipped));
+            }
+            row_exps.push_back(exp);
+            values.push_back(row);
+        }
+    }
+
+    std::string csv_path = results_dir + "/Summary.csv";
+    std::ofstream csv_file(csv_path);
+    if (!csv_file.is_open())
+    {
+        std::cerr << "Error opening the .csv file!!!" <<std::endl;
+        return EXIT_FAILURE;
+    }
+    for (size_t c = 0; c < header.size(); c++)
+    {
+        csv_file << (c ? "," : "") << header[c];
+    }
+    csv_file << "\n";
+    for (size_t r = 0; r < row_exps.size(); r++)
+    {
+        csv_file << row_exps[r]->gain_name << "," << row_exps[r]->move_name << "," << row_exps[r]->exp_name;
+        for (double value: values[r])
+        {
+            csv_file << ",";
+            if (!std::isnan(value))
+            {
+                csv_file << value;
+            }
+        }
+        csv_file << "\n";
+    }
+    csv_file.close();
+    std::cout << "/// Summary saved at                  :       " << csv_path << std::endl;
+
+    if (!settings.xlsx)
+    {
+        return EXIT_SUCCESS;
+    }
+
+    std::string xlsx_path = results_dir + "/Summary.xlsx";
+    lxw_workbook *workbook = workbook_new(xlsx_path.c_str());
+    if (workbook == nullptr)
+    {
+        std::cerr << "Error opening the .xlsx file!!!" << std::endl;
+        return EXIT_FAILURE;
+    }
+    lxw_worksheet *worksheet = workbook_add_worksheet(workbook, "Summary");
+    for (size_t c = 0; c < header.size(); c++)
+    {
+        worksheet_write_string(worksheet, 0, static_cast<lxw_col_t>(c), header[c].c_str(), nullptr);
+    }
+    for (size_t r = 0; r < row_exps.size(); r++)
+    {
+        lxw_row_t row = static_cast<lxw_row_t>(r + 1);
+        worksheet_write_string(worksheet, row, 0, row_exps[r]->gain_name.c_str(), nullptr);
+        worksheet_write_string(worksheet, row, 1, row_exps[r]->move_name.c_str(), nullptr);
+        worksheet_write_string(worksheet, row, 2, row_exps[r]->exp_name.c_str(), nullptr);
+        for (size_t c = 0; c < values[r].size(); c++)
+        {
+            if (std::isnan(values[r][c]))
+            {
+                continue;
+            }
+            worksheet_write_number(worksheet, row, static_cast<lxw_col_t>(c + 3), values[r][c], nullptr);
+        }
+    }
+    if (workbook_close(workbook) != LXW_NO_ERROR)
+    {
+        std::cerr << "Error writing the .xlsx file!!!" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "/// Summary saved at                  :       " << xlsx_path << std::endl;
+    return EXIT_SUCCESS;
+}
+
+void fill_distances(std::vector<FrameRow> &rows, const MovementTruth &truth, std::vector<double> &columns)
+{
+    const double det = (Txx * Tyy) - (Txy * Tyx);
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+
+    /* Expected displacement of frame N is base + N * step */
+    const double step_x = truth.valid && truth.per_frame ? truth.x : 0.0;
+    const double step_y = truth.valid && truth.per_frame ? truth.y : 0.0;
+    const double base_x = !truth.valid ? nan : (truth.per_frame ? 0.0 : truth.x);
+    const double base_y = !truth.valid ? nan : (truth.per_frame ? 0.0 : truth.y);
+
+    /* Inputs and outputs, one column per field. 'missed' is NaN for a frame that was not matched (unreadable, or its
+       search window smaller than the RoI) and 0 otherwise, so that adding it leaves no error for such a frame. */
+    const size_t n = rows.size();
+    columns.resize(10 * n);
+    double *shift_col = columns.data(), *shift_row = shift_col + n, *index = shift_row + n, *missed = index + n;
+    double *dist_x = missed + n, *dist_y = dist_x + n;
+    double *error_x = dist_y + n, *error_y = error_x + n, *error_x_pct = error_y + n, *error_y_pct = error_x_pct + n;
+    for (size_t k = 0; k < n; k++)
+    {
+        shift_col[k] = rows[k].ncc.shift_col;
+        shift_row[k] = rows[k].ncc.shift_row;
+        index[k] = static_cast<double>(rows[k].index);
+        missed[k] = rows[k].ncc.confidence > 0 ? 0.0 : nan;
+    }
+
+    for (size_t k = 0; k < n; k++)
+    {
+        // Comment the following for calibration
+        dist_x[k] = ((shift_col[k] * Tyy) - (shift_row[k] * Txy)) / det;
+        dist_y[k] = ((shift_row[k] * Txx) - (shift_col[k] * Tyx)) / det;
+    }
+    for (size_t k = 0; k < n; k++)
+    {
+        double expected_x = base_x + step_x * index[k] + missed[k];
+        double expected_y = base_y + step_y * index[k] + missed[k];
+        error_x[k] = dist_x[k] - expected_x;
+        error_y[k] = dist_y[k] - expected_y;
+
+        /* Division by 0 (no movement commanded along an axis) gives inf/NaN, which is written as an empty cell */
+        double pct_x = error_x[k] / std::abs(expected_x) * 100;
+        double pct_y = error_y[k] / std::abs(expected_y) * 100;
+        error_x_pct[k] = std::isinf(pct_x) ? nan : pct_x;
+        error_y_pct[k] = std::isinf(pct_y) ? nan : pct_y;
+    }
+
+    for (size_t k = 0; k < n; k++)
+    {
+        FrameRow &row = rows[k];
+        row.dist_x = dist_x[k];
+        row.dist_y = dist_y[k];
+        row.error_x = error_x[k];
+        row.error_y = error_y[k];
+        row.error_x_pct = error_x_pct[k];
+        row.error_y_pct = error_y_pct[k];
+    }
+}
+
+std::ostream &operator<<(std::ostream &stream, const CsvCell &cell)
+{
+    if (!std::isnan(cell.value))
+    {
+        stream << cell.value;
+    }
+    return stream;
+}
+
+MovementTruth read_movement(const std::string &movement_dir)
+{
+    MovementTruth truth;
+    std::ifstream movement_file(movement_dir + "/movement.txt");
+    if (!movement_file.is_open())
+    {
+        return truth;
+    }
+
+    bool has_x = false, has_y = false;
+    std::string line;
+    while (std::getline(movement_file, line))
+    {
+        std::stringstream line_stream(line.substr(0, line.find('#')));
+        std::string key;
+        double value;
+        if (!(line_stream >> key >> value))
+        {
+            continue;
+        }
+        if (key == "x")
+        {
+            truth.x = value;
+            has_x = true;
+        } else if (key == "y")
+        {
+            truth.y = value;
+            has_y = true;
+        } else if (key == "per_frame")
+        {
+            truth.per_frame = (value != 0);
+        }
+    }
+    truth.valid = has_x && has_y;
+    if (!truth.valid)
+    {
+        std::cerr << "/// movement.txt needs x and y        :       " << movement_dir << std::endl;
+    }
+    return truth;
+}
+
+bool natural_less(const std::string &a, const std::string &b)
+{
+    size_t digit_a = a.find_first_of("0123456789");
+    size_t digit_b = b.find_first_of("0123456789");
+    if (digit_a == std::string::npos || digit_b == std::string::npos || a.compare(0, digit_a, b, 0, digit_b) != 0)
+    {
+        return a < b;
+    }
+    long num_a = std::stol(a.substr(digit_a));
+    long num_b = std::stol(b.substr(digit_b));
+    return (num_a != num_b) ? (num_a < num_b) : (a < b);
+}
+
+int write_report(const std::vector<std::unique_ptr<Experiment>> &experiments)
+{
+    /* Axes of the tables */
+    std::vector<std::string> gains, moves, exps;
+    for (const auto &exp: experiments)
+    {
+        for (auto axis: {std::make_pair(&gains, &exp->gain_name), std::make_pair(&moves, &exp->move_name), std::make_pair(&exps, &exp->exp_name)})
+        {
+            if (std::find(axis.first->begin(), axis.first->end(), *axis.second) == axis.first->end())
+            {
+                axis.first->push_back(*axis.second);
+            }
+        }
+    }
+    for (auto *axis: {&gains, &moves, &exps})
+    {
+        std::sort(axis->begin(), axis->end(), natural_less);
+    }
+
+    /* Metrics compared across experiments */
+    std::vector<std::pair<std::string, std::function<double(const Experiment &, const ExperimentSummary &)>>> metrics = {
+        {"Mean Confidence (%)", [](const Experiment &, const ExperimentSummary &s) { return s.confidence.mean; }},
+        {"Mean MIG", [](const Experiment &, const ExperimentSummary &s) { return s.mig.mean; }},
+        {"Mean PSR", [](const Experiment &, const ExperimentSummary &s) { return s.psr.count ? s.psr.mean : std::numeric_limits<double>::quiet_NaN(); }},
+        {"Mean Dist. X (mm)", [](const Experiment &, const ExperimentSummary &s) { return s.dist_x.mean; }},
+        {"Mean Dist. Y (mm)", [](const Experiment &, const ExperimentSummary &s) { return s.dist_y.mean; }},
+        {"Std Dist. X (mm)", [](const Experiment &, const ExperimentSummary &s) { return s.dist_x.stddev(); }},
+        {"Std Dist. Y (mm)", [](const Experiment &, const ExperimentSummary &s) { return s.dist_y.stddev(); }},
+        {"Mean Error X (mm)", [](const Experiment &, const ExperimentSummary &s) { return s.error_x.count ? s.error_x.mean : std::numeric_limits<double>::quiet_NaN(); }},
+        {"Mean Error Y (mm)", [](const Experiment &, const ExperimentSummary &s) { return s.error_y.count ? s.error_y.mean : std::numeric_limits<double>::quiet_NaN(); }},
+        {"Frames/s (per core)", [](const Experiment &e, const ExperimentSummary &s) { return e.busy_seconds > 0 ? s.mig.count / e.busy_seconds : 0.0; }}};
+
+    /* Hardware counters per stage, per frame of the experiment */
+    if (settings.perf_counters)
+    {
+        const std::pair<const char *, PerfSample StagePerf::*> stages[] = {{"Decode", &StagePerf::decode}, {"MIG", &StagePerf::mig}, {"NCC", &StagePerf::ncc}};
+        for (const auto &stage: stages)
+        {
+            PerfSample StagePerf::*member = stage.second;
+            auto per_frame = [member](uint64_t PerfSample::*field)
+            {
+                return [member, field](const Experiment &e, const ExperimentSummary &) { return e.perf_frames > 0 ? static_cast<double>(e.perf.*member.*field) / e.perf_frames : std::numeric_limits<double>::quiet_NaN(); };
+            };
+            metrics.push_back({std::string(stage.first) + " Cycles/Frame", per_frame(&PerfSample::cycles)});
+            metrics.push_back({std::string(stage.first) + " IPC", [member](const Experiment &e, const ExperimentSummary &)
+            {
+                const PerfSample &sample = e.perf.*member;
+                return sample.cycles > 0 ? static_cast<double>(sample.instructions) / sample.cycles : std::numeric_limits<double>::quiet_NaN();
+            }});
+            metrics.push_back({std::string(stage.first) + " LLC Misses/Frame", per_frame(&PerfSample::llc_misses)});
+            metrics.push_back({std::string(stage.first) + " Branch Misses/Frame", per_frame(&PerfSample::branch_misses)});
+        }
+    }
+
+    std::string report_path = results_dir + "/Report.csv";
+    std::ofstream report_file(report_path);
+    if (!report_file.is_open())
+    {
+        std::cerr << "Error opening the .csv file!!!" <<std::endl;
+        return EXIT_FAILURE;
+    }
+
+    /* A sweep gets one row per RoI configuration */
+    const bool sweep = !settings.sweep.empty();
+    const size_t num_configs = sweep ? settings.sweep.size() : 1;
+
+    std::stringstream table;
+    for (const auto &metric: metrics)
+    {
+        table << metric.first << "\nGain,Move" << (sweep ? ",RoI" : "");
+        for (const auto &exp_name: exps)
+        {
+            table << "," << exp_name;
+        }
+        table << "\n";
+
+        for (const auto &gain_name: gains)
+        {
+            for (const auto &move_name: moves)
+            {
+                for (size_t c = 0; c < num_configs; c++)
+                {
+                    std::stringstream row;
+                    bool any = false;
+                    row << gain_name << "," << move_name;
+                    if (sweep)
+                    {
+                        row << "," << settings.sweep[c].label();
+                    }
+                    for (const auto &exp_name: exps)
+                    {
+                        row << ",";
+                        for (const auto &exp: experiments)
+                        {
+                            if (exp->gain_name == gain_name && exp->move_name == move_name && exp->exp_name == exp_name && exp->outputs[c].summary.frames > 0)
+                            {
+                                double value = metric.second(*exp, exp->outputs[c].summary);
+                                if (!std::isnan(value))
+                                {
+                                    row << value;
+                                    any = true;
+                                }
+                            }
+                        }
+                    }
+                    if (any)
+                    {
+                        table << row.str() << "\n";
+                    }
+                }
+            }
+        }
+        table << "\n";
+    }
+
+    report_file << table.str();
+    report_file.close();
+    std::cout << "\n" << table.str()
+              << "/// Report saved at                   :       " << report_path << std::endl;
+    return EXIT_SUCCESS;
+}
+
+WorkStealingScheduler::WorkStealingScheduler(unsigned num_workers)
+{
+    for (unsigned i = 0; i < num_workers; i++)
+    {
+        queues.push_back(std::make_unique<WorkerQueue>());
+    }
+}
+
+void WorkStealingScheduler::submit(const FrameChunk &chunk)
+{
+    MemoryScope queue_scope(MemoryStage::Queues);
+    WorkerQueue &queue = *queues[next_queue];
+    next_queue = (next_queue + 1) % queues.size();
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.chunks.push_back(chunk);
+}
+
+void WorkStealingScheduler::run(const std::function<void(const FrameChunk &chunk, unsigned worker_id)> &work)
+{
+    std::vector<std::thread> workers;
+    for (unsigned worker_id = 0; worker_id < queues.size(); worker_id++)
+    {
+        workers.emplace_back([this, &work, worker_id]()
+        {
+            if (worker_id < worker_cpus.size())
+            {
+                cpu_set_t cpu_set;
+                CPU_ZERO(&cpu_set);
+                CPU_SET(worker_cpus[worker_id], &cpu_set);
+                if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0)
+                {
+                    std::lock_guard<std::mutex> lock(log_mutex);
+                    std::cerr << "/// Could not pin worker " << worker_id << " to CPU " << worker_cpus[worker_id] << std::endl;
+                }
+            }
+
+            FrameChunk chunk;
+            while (pop_local(worker_id, chunk) || steal(worker_id, chunk))
+            {
+                work(chunk, worker_id);
+            }
+        });
+    }
+
+    for (auto &worker: workers)
+    {
+        worker.join();
+    }
+}
+
+bool WorkStealingScheduler::pop_local(unsigned worker_id, FrameChunk &chunk)
+{
+    WorkerQueue &queue = *queues[worker_id];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.chunks.empty())
+    {
+        return false;
+    }
+    chunk = queue.chunks.front();
+    queue.chunks.pop_front();
+    return true;
+}
+
+bool WorkStealingScheduler::steal(unsigned worker_id, FrameChunk &chunk)
+{
+    /*
+    * Victims are visited starting from the neighbour, so that thieves do not all pile onto worker 0.
+    * The first pass only visits workers on the thief's own NUMA node.
+    */
+    for (int pass = worker_nodes.empty() ? 1 : 0; pass < 2; pass++)
+    {
+        for (unsigned offset = 1; offset < queues.size(); offset++)
+        {
+            unsigned victim_id = (worker_id + offset) % queues.size();
+            if (pass == 0 && worker_nodes[victim_id] != worker_nodes[worker_id])
+            {
+                continue;
+            }
+
+            WorkerQueue &victim = *queues[victim_id];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.chunks.empty())
+            {
+                chunk = victim.chunks.back();
+                victim.chunks.pop_back();
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void WorkStealingScheduler::set_placement(const std::vector<int> &worker_cpus, const std::vector<int> &worker_nodes)
+{
+    this->worker_cpus = worker_cpus;
+    this->worker_nodes = worker_nodes;
+}
+
+CpuTopology read_cpu_topology()
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+
+    CpuTopology topology;
+    const std::string node_root = "/sys/devices/system/node";
+    for (int node = 0; std::filesystem::exists(node_root + "/node" + std::to_string(node)); node++)
+    {
+        std::ifstream cpulist_file(node_root + "/node" + std::to_string(node) + "/cpulist");
+        std::string cpu_list;
+        std::getline(cpulist_file, cpu_list);
+
+        std::vector<int> cpus;
+        for (int cpu: parse_cpu_list(cpu_list))
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        if (!cpus.empty())
+        {
+            topology.node_cpus.push_back(cpus);
+        }
+    }
+
+    if (topology.node_cpus.empty())
+    {
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        topology.node_cpus.push_back(cpus);
+    }
+    return topology;
+}
+
+std::vector<int> parse_cpu_list(const std::string &cpu_list)
+{
+    std::vector<int> cpus;
+    std::stringstream list_stream(cpu_list);
+    std::string range;
+    while (std::getline(list_stream, range, ','))
+    {
+        if (range.empty())
+        {
+            continue;
+        }
+        size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++)
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+void place_workers(WorkStealingScheduler &scheduler)
+{
+    CpuTopology topology = read_cpu_topology();
+
+    /* All CPUs node after node, together with the node they belong to */
+    std::vector<int> cpus, nodes;
+    for (size_t node = 0; node < topology.node_cpus.size(); node++)
+    {
+        std::cout << "/// NUMA node " << node << " CPUs                 :       ";
+        for (int cpu: topology.node_cpus[node])
+        {
+            std::cout << cpu << " ";
+            cpus.push_back(cpu);
+            nodes.push_back(static_cast<int>(node));
+        }
+        std::cout << std::endl;
+    }
+
+    /* Spreading the workers evenly, so that each node gets a share proportional to its number of CPUs */
+    std::vector<int> worker_cpus, worker_nodes;
+    for (unsigned worker_id = 0; worker_id < scheduler.size(); worker_id++)
+    {
+        size_t slot = (static_cast<size_t>(worker_id) * cpus.size()) / scheduler.size();
+        worker_cpus.push_back(cpus[slot]);
+        worker_nodes.push_back(nodes[slot]);
+        std::cout << "/// Worker " << worker_id << " pinned to                :       CPU " << cpus[slot] << " (node " << nodes[slot] << ")" << std::endl;
+    }
+    scheduler.set_placement(worker_cpus, worker_nodes);
+}
+
+void create_folders(const std::string &path)
+{
+    try
+    {
+        if (std::filesystem::exists(path))
+        {
+            std::cout << "\n////////////////////////////////////////////////////////////////////////////////////////\n" 
+                      << "/// Folder already exists at path     :       " << path 
+                      << "\n////////////////////////////////////////////////////////////////////////////////////////\n" 
+                      << std::endl;
+        } else
+        {
+            std::filesystem::create_directories(path);
+            std::cout << "\n////////////////////////////////////////////////////////////////////////////////////////\n"
+                      << "/// Folder created at path            :       " << path 
+                      << "\n////////////////////////////////////////////////////////////////////////////////////////\n"
+                      << std::endl;
+        }
+    } catch (const std::filesystem::filesystem_error &e)
+    {
+        std::cerr << "/// Error creating folder                 :       " << e.what() << std::endl; 
+    }
+}
+
+double mig_frame(const cv::Mat &frame)
+{
+    if (frame.empty())
+    {
+        std::cout << "Image is empty or corrupted. Please check file." << std::endl;
+        return EXIT_FAILURE;
+    }
+    cv::Mat1f dx, dy, mag; // Declare matrices to store float values
+    cv::Sobel(frame, dx, CV_32F, 1, 0, 3);
+    cv::Sobel(frame, dy, CV_32F ,0, 1, 3);
+    cv::magnitude(dx, dy, mag); // Source -> Destination
+    cv::Scalar total = cv::sum(mag);
+    double mig = total[0] / (frame.rows * frame.cols);
+    return mig;
+}
+
+cv::Mat get_roi(cv::Mat &frame, const int &width, const int &height, const int &topLeft_x, const int &topLeft_y)
+{
+    cv::Mat copy_frame;
+    frame.copyTo(copy_frame);
+    cv::Rect roiRect(topLeft_x, topLeft_y, width, height);
+    cv::Mat roi = copy_frame(roiRect);
+    return roi;
+}
+
+cv::Mat texture_integral(const cv::Mat &frame)
+{
+    cv::Mat grad_x, grad_y, energy, energy_integral;
+    cv::Sobel(frame, grad_x, CV_32F, 1, 0, 3);
+    cv::Sobel(frame, grad_y, CV_32F, 0, 1, 3);
+    cv::multiply(grad_x, grad_x, energy);
+    cv::multiply(grad_y, grad_y, grad_y);
+    cv::add(energy, grad_y, energy);
+    cv::integral(energy, energy_integral, CV_64F);
+    return energy_integral;
+}
+
+cv::Point place_roi(const cv::Mat &energy_integral, const int &width, const int &height, double center)
+{
+    const int cols = energy_integral.cols - 1;
+    const int rows = energy_integral.rows - 1;
+
+    /* Central part of the frame the RoI must lie in, never smaller than the RoI itself */
+    const int region_w = std::min(cols, std::max(width, static_cast<int>(cols * center)));
+    const int region_h = std::min(rows, std::max(height, static_cast<int>(rows * center)));
+    const int region_x = (cols - region_w) / 2;
+    const int region_y = (rows - region_h) / 2;
+
+    double best = -1;
+    cv::Point corner(region_x, region_y);
+    for (int y = region_y; y + height <= region_y + region_h; y++)
+    {
+        const double *top = energy_integral.ptr<double>(y);
+        const double *bottom = energy_integral.ptr<double>(y + height);
+        for (int x = region_x; x + width <= region_x + region_w; x++)
+        {
+            double texture = bottom[x + width] - bottom[x] - top[x + width] + top[x];
+            if (texture > best)
+            {
+                best = texture;
+                corner = cv::Point(x, y);
+            }
+        }
+    }
+    return corner;
+}
+
+LocAndConf get_results(cv::Mat &frame, cv::Mat &roi, const int &frameWidth, const int &frameHeight, const int &width, const int &height)
+{
+    LocAndConf a; // variable of the type struct
+    cv::Mat copy_frame;
+    cv::Mat copy_roi;
+    cv::Point minLoc;
+    cv::Point maxLoc;
+    cv::Mat result;
+    double minVal, maxVal;
+    frame.copyTo(copy_frame);
+    roi.copyTo(copy_roi);
+    cv::matchTemplate(copy_frame, copy_roi, result, cv::TM_CCORR_NORMED, cv::Mat());
+    cv::minMaxLoc(result, &minVal, &maxVal, &minLoc, &maxLoc, cv::Mat());
+    a.match_loc = maxLoc;
+    a.confidence = maxVal * 100;
+
+    // -ve value -> template moving up, +ve value -> template moving down
+    a.shift_row = (maxLoc.y + ((height)/2)) - ((frameHeight)/2);
+
+    // -ve value -> template moving left, +ve value -> template moving right
+    a.shift_col = (maxLoc.x + ((width)/2)) - ((frameWidth)/2);
+    return a;
+}
+
+int write_synthetic_experiment(const std::string &root_path)
+{
+    const int step_col = synthetic_step_col, step_row = synthetic_step_row;
+    const int margin = synthetic_frames * 2;
+    const cv::Mat field = synthetic_field(margin);
+
+    const std::string movement_dir = root_path + "/Gain_1/Move_1";
+    const std::string exp_dir = movement_dir + "/Exp_1";
+    std::filesystem::create_directories(exp_dir);
+    for (int i = 0; i < synthetic_frames; i++)
+    {
+        /* The crop moves against the content, so the speckle moves by +step */
+        cv::Rect crop(margin - i * step_col, margin - i * step_row, frameWidth, frameHeight);
+        if (!cv::imwrite(exp_dir + "/frame_" + std::to_string(i) + ".png", field(crop)))
+        {
+            std::cerr << "Error writing the synthetic frames!!!" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* Movement per frame in mm, the pixel step converted like fill_distances() does */
+    const double det = (Txx * Tyy) - (Txy * Tyx);
+    std::ofstream movement_file(movement_dir + "/movement.txt");
+    if (!movement_file.is_open())
+    {
+        std::cerr << "Error writing movement.txt!!!" << std::endl;
+        return EXIT_FAILURE;
+    }
+    movement_file << "# synthetic experiment, " << step_col << " column(s) and " << step_row << " row(s) per frame\n"
+                  << "x " << ((step_col * Tyy) - (step_row * Txy)) / det << "\n"
+                  << "y " << ((step_row * Txx) - (step_col * Tyx)) / det << "\n"
+                  << "per_frame 1" << std::endl;
+
+    std::cout << "/// Synthetic experiment written      :       " << exp_dir << std::endl;
+    return EXIT_SUCCESS;
+}
+
+cv::Mat synthetic_field(int margin)
+{
+    /* Speckle field larger than a frame, every frame is a crop of it moved by one step more */
+    cv::Mat field(frameHeight + 2 * margin, frameWidth + 2 * margin, CV_8UC1);
+    cv::theRNG().state = 0x4d4947;
+    cv::randu(field, cv::Scalar(0), cv::Scalar(255));
+    cv::GaussianBlur(field, field, cv::Size(5, 5), 1.5);
+    return field;
+}
+
+int run_accuracy_check()
+{
+    /* Bounds of one path against the reference (MIG NaN -> not compared) and the largest deviations seen */
+    struct Check
+    {
+        const char *path;
+        int shift_bound;
+        double confidence_bound, mig_bound;
+        int shift = 0;
+        double confidence = 0, mig = 0;
+    };
+    std::vector<Check> checks = {
+        {"reference vs. ground truth", 0, std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::quiet_NaN()},
+        {"fused kernels, 8 bit", 0, 0.01, 1e-4},
+        {"fused kernels, 16 bit (NCC as float)", 0, 0.01, 1e-4},
+        {"spectral (--sweep)", 0, 0.1, std::numeric_limits<double>::quiet_NaN()},
+        {"search window (--search-margin)", 0, 0.01, std::numeric_limits<double>::quiet_NaN()},
+        {"tracking (--track)", 0, 0.01, std::numeric_limits<double>::quiet_NaN()},
+        {"preview (--preview-scale 0.5)", 2, 2.0, std::numeric_limits<double>::quiet_NaN()},
+    };
+    auto record = [](Check &check, const LocAndConf &reference, double reference_mig, const LocAndConf &a, double mig)
+    {
+        check.shift = std::max({check.shift, std::abs(a.shift_col - reference.shift_col), std::abs(a.shift_row - reference.shift_row)});
+        check.confidence = std::max(check.confidence, std::abs(a.confidence - reference.confidence));
+        if (!std::isnan(check.mig_bound))
+        {
+            check.mig = std::max(check.mig, std::abs(mig - reference_mig) / reference_mig);
+        }
+    };
+
+    /* The search window paths need a margin */
+    if (settings.search_margin < 0)
+    {
+        settings.search_margin = 16;
+    }
+
+    const int margin = synthetic_frames * 2;
+    const cv::Mat field = synthetic_field(margin);
+    const cv::Size frame_size(frameWidth, frameHeight);
+    const cv::Rect frame_rect(0, 0, frameWidth, frameHeight);
+    cv::Mat frame_0 = field(cv::Rect(margin, margin, frameWidth, frameHeight)).clone();
+    FrameScratch scratch;
+
+    /* The RoI of --auto-roi, placed on frame_0 like main() places it, in the central half so it never leaves the frames */
+    cv::Point placed = place_roi(texture_integral(frame_0), roi_w, roi_h, 0.5);
+
+    for (const RoiConfig &config: {RoiConfig{topLeft_x, topLeft_y, roi_w, roi_h}, RoiConfig{100, 100, 64, 64}, RoiConfig{placed.x, placed.y, roi_w, roi_h}})
+    {
+        /* RoI of frame 0 at every depth and scale, and its spectrum */
+        cv::Mat roi = get_roi(frame_0, config.w, config.h, config.x, config.y);
+        cv::Mat roi_16;
+        roi.convertTo(roi_16, CV_16U, 257);
+        TemplateSpectrum spectrum;
+        cv::Mat1f padded;
+        template_spectrum(roi, frame_size, padded, spectrum);
+
+        /* The preview runs through preview_frame(), on an experiment holding just this RoI */
+        Experiment preview;
+        preview.outputs.emplace_back();
+        preview.outputs[0].config = config;
+        preview.outputs[0].window = frame_rect;
+        cv::resize(roi, preview.outputs[0].preview_roi, cv::Size(), 0.5, 0.5, cv::INTER_AREA);
+
+        ShiftFilter tracker;
+        std::vector<FrameRow> preview_rows;
+        for (int i = 0; i < synthetic_frames; i++)
+        {
+            cv::Mat frame = field(cv::Rect(margin - i * synthetic_step_col, margin - i * synthetic_step_row, frameWidth, frameHeight)).clone();
+            cv::Mat frame_16;
+            frame.convertTo(frame_16, CV_16U, 257);
+
+            /* The reference measures from the center of the frame, the shifts are compared from the RoI */
+            LocAndConf reference = get_results(frame, roi, frameWidth, frameHeight, config.w, config.h);
+            reference.shift_col = reference.match_loc.x - config.x;
+            reference.shift_row = reference.match_loc.y - config.y;
+            double reference_mig = mig_frame(frame);
+
+            LocAndConf truth = reference;
+            truth.shift_col = i * synthetic_step_col;
+            truth.shift_row = i * synthetic_step_row;
+            record(checks[0], truth, reference_mig, reference, reference_mig);
+
+            record(checks[1], reference, reference_mig, get_results(frame, roi, config.tl(), scratch), mig_frame(frame, scratch));
+            record(checks[2], reference, reference_mig, get_results(frame_16, roi_16, config.tl(), scratch), mig_frame(frame_16, scratch) / 257);
+
+            frame_spectrum(frame, scratch.spectrum);
+            record(checks[3], reference, reference_mig, match_spectral(scratch.spectrum, spectrum, config.w, config.h, frame_rect, config.tl(), scratch), 0);
+
+            /* Windowed matches moved back into frame coordinates like process_chunk() does */
+            for (size_t c = 4; c <= 5; c++)
+            {
+                cv::Rect window = c == 4 ? search_window(config, frame_size) : tracking_window(config, tracker, frame_size);
+                LocAndConf a = get_results(frame(window), roi, config.tl() - window.tl(), scratch);
+                record(checks[c], reference, reference_mig, a, 0);
+                if (c == 5)
+                {
+                    tracker.update(a.shift_col, a.shift_row, settings.kalman_q, settings.kalman_r);
+                }
+            }
+
+            preview_rows.clear();
+            preview_frame(preview, i, frame, 0.5, scratch, preview_rows);
+            record(checks[6], reference, reference_mig, preview_rows[0].ncc, 0);
+        }
+    }
+
+    /* Decoders against their reference, pixel for pixel: SIMD Mono12p unpacking against the scalar version (a whole
+       frame and a short run that ends in the scalar tail), libpng row decoding against cv::imdecode() */
+    struct DecoderCheck
+    {
+        std::string path;
+        double diff;
+    };
+    std::vector<DecoderCheck> decoders;
+    for (size_t num_pixels: {static_cast<size_t>(frameWidth) * frameHeight, static_cast<size_t>(22)})
+    {
+        cv::Mat packed(1, static_cast<int>(num_pixels / 2 * 3), CV_8UC1);
+        cv::randu(packed, cv::Scalar(0), cv::Scalar(256));
+        cv::Mat expected(1, static_cast<int>(num_pixels), CV_16UC1), unpacked(1, static_cast<int>(num_pixels), CV_16UC1);
+        unpack_mono12p_scalar(packed.ptr<uchar>(), expected.ptr<uint16_t>(), num_pixels);
+        const std::string pixels = " (" + std::to_string(num_pixels) + " pixels)";
+#if defined(__x86_64__) || defined(__i386__)
+        if (__builtin_cpu_supports("ssse3"))
+        {
+            unpack_mono12p_ssse3(packed.ptr<uchar>(), unpacked.ptr<uint16_t>(), num_pixels);
+            decoders.push_back({"Mono12p SSSE3 vs. scalar" + pixels, cv::norm(unpacked, expected, cv::NORM_INF)});
+        }
+        if (__builtin_cpu_supports("avx2"))
+        {
+            unpack_mono12p_avx2(packed.ptr<uchar>(), unpacked.ptr<uint16_t>(), num_pixels);
+            decoders.push_back({"Mono12p AVX2 vs. scalar" + pixels, cv::norm(unpacked, expected, cv::NORM_INF)});
+        }
+#endif
+    }
+#ifdef HAVE_LIBPNG
+    for (int depth: {CV_8U, CV_16U})
+    {
+        cv::Mat frame;
+        frame_0.convertTo(frame, depth, depth == CV_16U ? 257 : 1);
+        std::vector<uchar> png;
+        cv::imencode(".png", frame, png);
+
+        /* The flags of decode_bytes(), and half of the rows like a --mig-window run that stops early */
+        const int flags = settings.png_8bit ? cv::IMREAD_GRAYSCALE : (cv::IMREAD_GRAYSCALE | cv::IMREAD_ANYDEPTH);
+        const int rows = frameHeight / 2;
+        cv::Mat expected = cv::imdecode(png, flags), decoded;
+        double diff = decode_png_rows(png.data(), png.size(), rows, decoded) >= rows ? cv::norm(decoded.rowRange(0, rows), expected.rowRange(0, rows), cv::NORM_INF) : std::numeric_limits<double>::infinity();
+        decoders.push_back({std::string("libpng rows vs. cv::imdecode, ") + (depth == CV_16U ? "16" : "8") + " bit", diff});
+    }
+#endif
+
+    std::cout << "/// Accuracy of the fast paths against the reference on " << synthetic_frames << " synthetic frames, with three RoIs\n"
+              << "path,max shift diff (px),bound,max confidence diff (%),bound,max MIG rel. error,bound,result" << std::endl;
+    bool passed = true;
+    for (const Check &check: checks)
+    {
+        bool ok = check.shift <= check.shift_bound
+                  && (std::isnan(check.confidence_bound) || check.confidence <= check.confidence_bound)
+                  && (std::isnan(check.mig_bound) || check.mig <= check.mig_bound);
+        passed = passed && ok;
+        auto cell = [](double value, double bound) { return std::isnan(bound) ? std::string("-") : std::to_string(value); };
+        std::cout << check.path << "," << check.shift << "," << check.shift_bound << ","
+                  << cell(check.confidence, check.confidence_bound) << "," << cell(check.confidence_bound, check.confidence_bound) << ","
+                  << cell(check.mig, check.mig_bound) << "," << cell(check.mig_bound, check.mig_bound) << ","
+                  << (ok ? "ok" : "FAILED") << std::endl;
+    }
+
+    std::cout << "/// Decoders against their reference\n"
+              << "decoder,max pixel diff,result" << std::endl;
+    for (const DecoderCheck &check: decoders)
+    {
+        passed = passed && check.diff == 0;
+        std::cout << check.path << "," << check.diff << "," << (check.diff == 0 ? "ok" : "FAILED") << std::endl;
+    }
+    std::cout << (passed ? "/// All paths are within their bounds" : "/// Some paths are out of their bounds") << std::endl;
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int run_benchmarks(const std::string &json_path)
+{
+    const int repetitions = 10;
+
+    /* One core, so that the numbers do not depend on what else the machine runs */
+    cv::setNumThreads(1);
+
+    const int margin = synthetic_frames * 2;
+    const cv::Mat field = synthetic_field(margin);
+    std::vector<cv::Mat> frames;
+    std::vector<std::vector<uchar>> encoded(synthetic_frames);
+    for (int i = 0; i < synthetic_frames; i++)
+    {
+        frames.push_back(field(cv::Rect(margin - i * synthetic_step_col, margin - i * synthetic_step_row, frameWidth, frameHeight)).clone());
+        cv::imencode(".png", frames.back(), encoded[i]);
+    }
+    cv::Mat roi = get_roi(frames[0], roi_w, roi_h, topLeft_x, topLeft_y);
+    FrameScratch scratch;
+
+    /* Times one pass over the synthetic frames, after one untimed pass, returns frames per second */
+    auto measure = [&](const std::function<void(int)> &work)
+    {
+        std::vector<double> samples;
+        for (int r = -1; r < repetitions; r++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < synthetic_frames; i++)
+            {
+                work(i);
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (r >= 0)
+            {
+                samples.push_back(synthetic_frames / elapsed.count());
+            }
+        }
+        return samples;
+    };
+
+    volatile double sink = 0;
+    BenchmarkRun run;
+#ifdef GIT_COMMIT
+    run.commit = GIT_COMMIT;
+#else
+    run.commit = "unknown";
+#endif
+    run.cpu = cpu_model();
+    char date[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+    run.date = date;
+
+    run.samples.emplace_back("mig_frame", measure([&](int i) { sink = sink + mig_frame(frames[i], scratch); }));
+    run.samples.emplace_back("get_results", measure([&](int i) { sink = sink + get_results(frames[i], roi, cv::Point(topLeft_x, topLeft_y), scratch).confidence; }));
+    run.samples.emplace_back("end_to_end", measure([&](int i)
+    {
+        cv::Mat img = decode_bytes(encoded[i].data(), encoded[i].size(), PixelFormat::Encoded, frameHeight, scratch.frame16, scratch.frame);
+        sink = sink + mig_frame(img, scratch) + get_results(img, roi, cv::Point(topLeft_x, topLeft_y), scratch).confidence;
+    }));
+
+    std::ofstream json_file(json_path);
+    if (!json_file.is_open())
+    {
+        std::cerr << "Error opening the benchmark file!!!" << std::endl;
+        return EXIT_FAILURE;
+    }
+    json_file << "{\n"
+              << "  \"commit\": \"" << run.commit << "\",\n"
+              << "  \"cpu\": \"" << run.cpu << "\",\n"
+              << "  \"date\": \"" << run.date << "\",\n"
+              << "  \"unit\": \"frames/s\",\n"
+              << "  \"benchmarks\": {\n";
+    std::cout << "/// Benchmarks of commit " << run.commit << " on " << run.cpu << " (frames/s, mean of " << repetitions << ")" << std::endl;
+    for (size_t b = 0; b < run.samples.size(); b++)
+    {
+        const std::vector<double> &samples = run.samples[b].second;
+        json_file << "    \"" << run.samples[b].first << "\": [";
+        for (size_t k = 0; k < samples.size(); k++)
+        {
+            json_file << (k > 0 ? ", " : "") << samples[k];
+        }
+        json_file << "]" << (b + 1 < run.samples.size() ? "," : "") << "\n";
+        std::cout << run.samples[b].first << "," << std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size() << std::endl;
+    }
+    json_file << "  }\n}" << std::endl;
+    std::cout << "/// Benchmark results written         :       " << json_path << std::endl;
+    return EXIT_SUCCESS;
+}
+
+int compare_benchmarks(const std::string &baseline_path, const std::string &current_path)
+{
+    BenchmarkRun baseline, current;
+    if (!read_benchmarks(baseline_path, baseline) || !read_benchmarks(current_path, current))
+    {
+        return EXIT_FAILURE;
+    }
+    if (baseline.cpu != current.cpu)
+    {
+        std::cout << "/// The runs are from different CPUs, the comparison is not meaningful:\n"
+                  << "///     " << baseline.cpu << "\n///     " << current.cpu << std::endl;
+    }
+
+    std::cout << "/// " << current.commit << " (" << current.date << ") against " << baseline.commit << " (" << baseline.date << ")\n"
+              << "benchmark,baseline (frames/s),current (frames/s),change (%),p,result" << std::endl;
+    bool regressed = false;
+    for (const auto &entry: current.samples)
+    {
+        auto base = std::find_if(baseline.samples.begin(), baseline.samples.end(), [&entry](const auto &b) { return b.first == entry.first; });
+        if (base == baseline.samples.end() || base->second.empty() || entry.second.empty())
+        {
+            std::cout << entry.first << ",,,,,not in both runs" << std::endl;
+            continue;
+        }
+        double base_mean = std::accumulate(base->second.begin(), base->second.end(), 0.0) / base->second.size();
+        double mean = std::accumulate(entry.second.begin(), entry.second.end(), 0.0) / entry.second.size();
+        double p = permutation_p_value(base->second, entry.second);
+        bool regression = mean < base_mean && p < 0.01;
+        regressed = regressed || regression;
+        std::cout << entry.first << "," << base_mean << "," << mean << "," << (mean / base_mean - 1) * 100 << "," << p << ","
+                  << (regression ? "REGRESSION" : "ok") << std::endl;
+    }
+    return regressed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+bool read_benchmarks(const std::string &path, BenchmarkRun &run)
+{
+    std::ifstream json_file(path);
+    if (!json_file.is_open())
+    {
+        std::cerr << "/// Could not read the benchmark file :       " << path << std::endl;
+        return false;
+    }
+
+    /* Every value is on a line of its own: "key": "text" or "key": [numbers] */
+    std::string line;
+    while (std::getline(json_file, line))
+    {
+        size_t key_begin = line.find('"');
+        size_t key_end = line.find('"', key_begin + 1);
+        size_t colon = line.find(':', key_end);
+        if (key_begin == std::string::npos || key_end == std::string::npos || colon == std::string::npos)
+        {
+            continue;
+        }
+        std::string key = line.substr(key_begin + 1, key_end - key_begin - 1);
+        std::string value = line.substr(colon + 1);
+
+        size_t bracket = value.find('[');
+        if (bracket != std::string::npos)
+        {
+            std::string numbers = value.substr(bracket + 1, value.find(']') - bracket - 1);
+            std::replace(numbers.begin(), numbers.end(), ',', ' ');
+            std::stringstream number_stream(numbers);
+            std::vector<double> samples;
+            double sample;
+            while (number_stream >> sample)
+            {
+                samples.push_back(sample);
+            }
+            run.samples.emplace_back(key, samples);
+            continue;
+        }
+
+        size_t text_begin = value.find('"');
+        size_t text_end = value.rfind('"');
+        if (text_begin == std::string::npos || text_end == text_begin)
+        {
+            continue;
+        }
+        std::string text = value.substr(text_begin + 1, text_end - text_begin - 1);
+        if (key == "commit")
+        {
+            run.commit = text;
+        } else if (key == "cpu")
+        {
+            run.cpu = text;
+        } else if (key == "date")
+        {
+            run.date = text;
+        }
+    }
+
+    if (run.samples.empty())
+    {
+        std::cerr << "/// No benchmark results in           :       " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+double permutation_p_value(const std::vector<double> &baseline, const std::vector<double> &current)
+{
+    const int permutations = 20000;
+    auto mean = [](std::vector<double>::const_iterator begin, std::vector<double>::const_iterator end)
+    {
+        return std::accumulate(begin, end, 0.0) / (end - begin);
+    };
+
+    std::vector<double> pooled(baseline);
+    pooled.insert(pooled.end(), current.begin(), current.end());
+    const double observed = mean(baseline.begin(), baseline.end()) - mean(current.begin(), current.end());
+
+    /* Fixed seed, the same files always give the same answer */
+    std::mt19937 rng(12345);
+    int as_extreme = 0;
+    for (int k = 0; k < permutations; k++)
+    {
+        std::shuffle(pooled.begin(), pooled.end(), rng);
+        auto split = pooled.cbegin() + static_cast<std::ptrdiff_t>(baseline.size());
+        if (mean(pooled.cbegin(), split) - mean(split, pooled.cend()) >= observed)
+        {
+            as_extreme++;
+        }
+    }
+    return (as_extreme + 1.0) / (permutations + 1.0);
+}
+
+std::string cpu_model()
+{
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line))
+    {
+        if (line.compare(0, 10, "model name") == 0)
+        {
+            size_t colon = line.find(':');
+            size_t begin = line.find_first_not_of(" \t", colon + 1);
+            if (colon != std::string::npos && begin != std::string::npos)
+            {
+                return line.substr(begin);
+            }
+        }
+    }
+    return "unknown";
+}
+
+FrameScratch::FrameScratch()
+{
+    {
+        MemoryScope ncc_scope(MemoryStage::Ncc);
+        result = cv::Mat(frameHeight - roi_h + 1, frameWidth - roi_w + 1, CV_32FC1, cv::Scalar(0));
+    }
+
+    MemoryScope decode_scope(MemoryStage::Decode);
+    frame = cv::Mat(frameHeight, frameWidth, CV_8UC1, cv::Scalar(0));
+
+    /* Touching the file buffer once, clear() keeps the capacity */
+    file_bytes.assign(static_cast<size_t>(frameWidth) * frameHeight, 0);
+    file_bytes.clear();
+
+    if (settings.prefetch_depth > 0)
+    {
+        prefetcher = std::make_unique<FramePrefetcher>(settings.prefetch_depth);
+    }
+
+    open_perf_counters();
+}
+
+void FrameScratch::open_perf_counters()
+{
+    perf.reset();
+    perf_thread = std::this_thread::get_id();
+    if (settings.perf_counters)
+    {
+        perf = std::make_unique<PerfCounters>();
+        if (!perf->available())
+        {
+            perf.reset();
+            static std::once_flag warned;
+            std::call_once(warned, []()
+            {
+                std::cerr << "/// Hardware counters are not available (see /proc/sys/kernel/perf_event_paranoid), Counters.csv stays 0" << std::endl;
+            });
+        }
+    }
+}
+
+PerfCounters::PerfCounters()
+{
+    const std::pair<uint64_t, uint64_t PerfSample::*> events[] = {
+        {PERF_COUNT_HW_CPU_CYCLES, &PerfSample::cycles},
+        {PERF_COUNT_HW_INSTRUCTIONS, &PerfSample::instructions},
+        {PERF_COUNT_HW_CACHE_MISSES, &PerfSample::llc_misses},
+        {PERF_COUNT_HW_BRANCH_MISSES, &PerfSample::branch_misses}};
+
+    for (const auto &event: events)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = event.first;
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        /* This thread on any CPU, the first counter leads the group */
+        int group = fds.empty() ? -1 : fds[0];
+        int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+        if (fd < 0)
+        {
+            if (fds.empty())
+            {
+                return;
+            }
+            continue;
+        }
+        fds.push_back(fd);
+        fields.push_back(event.second);
+    }
+}
+
+PerfCounters::~PerfCounters()
+{
+    for (int fd: fds)
+    {
+        close(fd);
+    }
+}
+
+PerfSample PerfCounters::read() const
+{
+    PerfSample sample;
+    if (fds.empty())
+    {
+        return sample;
+    }
+
+    /* Group read format: number of counters, then their values in the order they were opened */
+    uint64_t values[5] = {};
+    if (::read(fds[0], values, sizeof(values)) < static_cast<ssize_t>(sizeof(uint64_t)))
+    {
+        return sample;
+    }
+    for (size_t i = 0; i < fields.size() && i < values[0]; i++)
+    {
+        sample.*fields[i] = values[i + 1];
+    }
+    return sample;
+}
+
+MemoryScope::MemoryScope(MemoryStage stage) : previous(memory_stage)
+{
+    memory_stage = stage;
+}
+
+MemoryScope::~MemoryScope()
+{
+    memory_stage = previous;
+}
+
+void record_allocation(MemoryStage stage, size_t bytes)
+{
+    MemoryCounters &counters = memory_counters[static_cast<size_t>(stage)];
+    counters.allocations.fetch_add(1, std::memory_order_relaxed);
+    counters.allocated_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    counters.live_buffers.fetch_add(1, std::memory_order_relaxed);
+    int64_t live = counters.live_bytes.fetch_add(static_cast<int64_t>(bytes), std::memory_order_relaxed) + static_cast<int64_t>(bytes);
+    int64_t peak = counters.peak_live_bytes.load(std::memory_order_relaxed);
+    while (live > peak && !counters.peak_live_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+    {
+    }
+}
+
+void record_release(MemoryStage stage, size_t bytes)
+{
+    MemoryCounters &counters = memory_counters[static_cast<size_t>(stage)];
+    counters.live_buffers.fetch_sub(1, std::memory_order_relaxed);
+    counters.live_bytes.fetch_sub(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+}
+
+#ifdef MIG_MEMORY_STATS
+/*
+* Every block from operator new starts with this header, so that operator delete knows what to take off and from
+* which stage. Blocks allocated while the accounting was off are not counted when they are freed either.
+*/
+struct AllocationHeader
+{
+    size_t size;
+    MemoryStage stage;
+    bool counted;
+};
+static constexpr size_t allocation_header_size = alignof(std::max_align_t);
+static_assert(sizeof(AllocationHeader) <= allocation_header_size, "the header must not break the alignment of new");
+
+static void *counted_new(size_t size) noexcept
+{
+    void *block = std::malloc(size + allocation_header_size);
+    if (block == nullptr)
+    {
+        return nullptr;
+    }
+    AllocationHeader *header = static_cast<AllocationHeader *>(block);
+    header->size = size;
+    header->stage = memory_stage;
+    header->counted = memory_accounting.load(std::memory_order_relaxed);
+    if (header->counted)
+    {
+        record_allocation(header->stage, size);
+    }
+    return static_cast<char *>(block) + allocation_header_size;
+}
+
+static void counted_delete(void *ptr) noexcept
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+    void *block = static_cast<char *>(ptr) - allocation_header_size;
+    const AllocationHeader *header = static_cast<const AllocationHeader *>(block);
+    if (header->counted)
+    {
+        record_release(header->stage, header->size);
+    }
+    std::free(block);
+}
+
+void *operator new(size_t size)
+{
+    void *ptr = counted_new(size);
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return counted_new(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return counted_new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    counted_delete(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    counted_delete(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    counted_delete(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    counted_delete(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+    counted_delete(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept
+{
+    counted_delete(ptr);
+}
+#endif
+
+cv::UMatData *CountingMatAllocator::allocate(int dims, const int *sizes, int type, void *data, size_t *step, cv::AccessFlag flags, cv::UMatUsageFlags usage) const
+{
+    cv::UMatData *u = cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage);
+    if (u != nullptr)
+    {
+        /* Freed through this allocator, the stage travels in userdata (stage + 1, 0 -> not counted) */
+        u->currAllocator = this;
+        u->userdata = reinterpret_cast<void *>(static_cast<uintptr_t>(memory_stage) + 1);
+        record_allocation(memory_stage, u->size);
+    }
+    return u;
+}
+
+bool CountingMatAllocator::allocate(cv::UMatData *data, cv::AccessFlag access, cv::UMatUsageFlags usage) const
+{
+    return cv::Mat::getStdAllocator()->allocate(data, access, usage);
+}
+
+void CountingMatAllocator::deallocate(cv::UMatData *data) const
+{
+    if (data == nullptr)
+    {
+        return;
+    }
+    uintptr_t stage = reinterpret_cast<uintptr_t>(data->userdata);
+    if (stage != 0)
+    {
+        record_release(static_cast<MemoryStage>(stage - 1), data->size);
+    }
+    data->userdata = nullptr;
+    cv::Mat::getStdAllocator()->deallocate(data);
+}
+
+int write_memory_report()
+{
+    const char *names[] = {"Decode", "MIG", "NCC", "Writer", "Queues", "Other"};
+    const double mb = 1024.0 * 1024.0;
+    const uint64_t frames = memory_frames.load();
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    const double peak_rss = usage.ru_maxrss / 1024.0;
+
+    std::stringstream table;
+    table << "Stage,Allocations,Allocations/Frame,Allocated (MB),Live Buffers,Live (MB),Peak Live (MB)\n";
+    for (size_t k = 0; k < static_cast<size_t>(MemoryStage::Count); k++)
+    {
+        const MemoryCounters &counters = memory_counters[k];
+        table << names[k] << "," << counters.allocations << ","
+              << (frames > 0 ? static_cast<double>(counters.allocations) / frames : 0.0) << ","
+              << counters.allocated_bytes / mb << "," << counters.live_buffers << ","
+              << counters.live_bytes / mb << "," << counters.peak_live_bytes / mb << "\n";
+    }
+    table << "\nFrames," << frames << "\nPeak RSS (MB)," << peak_rss
+          << "\nCounted," << (memory_counts_new ? "operator new and cv::Mat buffers" : "cv::Mat buffers only") << "\n";
+
+    std::string memory_path = results_dir + "/Memory.csv";
+    std::ofstream memory_file(memory_path);
+    if (!memory_file.is_open())
+    {
+        std::cerr << "Error opening the .csv file!!!" <<std::endl;
+        return EXIT_FAILURE;
+    }
+    memory_file << table.str();
+    std::cout << "\n" << table.str()
+              << "/// Memory statistics saved at        :       " << memory_path << std::endl;
+    return EXIT_SUCCESS;
+}
+
+/*
+* MIG of a frame with one pass over its pixels: 3x3 Sobel gradients (BORDER_REFLECT_101 like cv::Sobel), their float
+* magnitude and the sum are computed row by row, so no gradient or magnitude buffer is ever written. The two reflected
+* border columns are peeled off, and the inner columns are summed into one float partial sum per vector lane, so the
+* column loop vectorizes without reassociating a single sum.
+*/
+template <typename Pixel>
+HOT_KERNEL double mig_kernel(const cv::Mat &frame)
+{
+    using Gradient = typename DepthTraits<Pixel>::Gradient;
+    const int rows = frame.rows, cols = frame.cols;
+    const int lanes = 16;
+    double total = 0;
+
+    for (int y = 0; y < rows; y++)
+    {
+        /* Reflect 101: row -1 is row 1 and row 'rows' is row 'rows - 2' */
+        const Pixel *up = frame.ptr<Pixel>(y > 0 ? y - 1 : 1);
+        const Pixel *mid = frame.ptr<Pixel>(y);
+        const Pixel *down = frame.ptr<Pixel>(y < rows - 1 ? y + 1 : rows - 2);
+
+        auto magnitude_at = [&](int left, int x, int right)
+        {
+            Gradient gx = static_cast<Gradient>((up[right] + 2 * mid[right] + down[right]) - (up[left] + 2 * mid[left] + down[left]));
+            Gradient gy = static_cast<Gradient>((down[left] + 2 * down[x] + down[right]) - (up[left] + 2 * up[x] + up[right]));
+            float fx = static_cast<float>(gx), fy = static_cast<float>(gy);
+            return std::sqrt(fx * fx + fy * fy);
+        };
+
+        double row_sum = magnitude_at(1, 0, 1) + magnitude_at(cols - 2, cols - 1, cols - 2);
+        float partial[lanes] = {};
+        int x = 1;
+        for (; x + lanes <= cols - 1; x += lanes)
+        {
+            for (int j = 0; j < lanes; j++)
+            {
+                partial[j] += magnitude_at(x + j - 1, x + j, x + j + 1);
+            }
+        }
+        for (; x < cols - 1; x++)
+        {
+            row_sum += magnitude_at(x - 1, x, x + 1);
+        }
+        for (int j = 0; j < lanes; j++)
+        {
+            row_sum += partial[j];
+        }
+        total += row_sum;
+    }
+    return total / (static_cast<double>(rows) * cols);
+}
+
+/*
+* NCC of a frame of one depth. Depths matchTemplate() takes natively are matched as they are, the others are converted
+* to float. A float RoI is used as it is, the experiments convert theirs once (Experiment::RoiOutput::roi_f).
+* matchTemplate() has no 16 bit integer path, so a 16 bit frame costs one conversion pass and a float correlation;
+* match_kernel<uint16_t> is that conversion, not a 16 bit NCC.
+*/
+template <typename Pixel>
+void match_kernel(const cv::Mat &frame, const cv::Mat &roi, FrameScratch &scratch)
+{
+    if constexpr (DepthTraits<Pixel>::native_match)
+    {
+        cv::matchTemplate(frame, roi, scratch.result, cv::TM_CCORR_NORMED, cv::Mat());
+    } else
+    {
+        const cv::Mat *roi_f = &roi;
+        if (roi.depth() != CV_32F)
+        {
+            roi.convertTo(scratch.roi_f, CV_32F);
+            roi_f = &scratch.roi_f;
+        }
+        frame.convertTo(scratch.frame_f, CV_32F);
+        cv::matchTemplate(scratch.frame_f, *roi_f, scratch.result, cv::TM_CCORR_NORMED, cv::Mat());
+    }
+}
+
+double mig_frame(const cv::Mat &frame, FrameScratch &)
+{
+    if (frame.empty())
+    {
+        std::cout << "Image is empty or corrupted. Please check file." << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (frame.rows < 2 || frame.cols < 2 || frame.channels() != 1)
+    {
+        return mig_frame(frame);
+    }
+
+    switch (frame.depth())
+    {
+    case DepthTraits<uchar>::depth:
+        return mig_kernel<uchar>(frame);
+    case DepthTraits<uint16_t>::depth:
+        return mig_kernel<uint16_t>(frame);
+    default:
+        return mig_frame(frame);
+    }
+}
+
+LocAndConf get_results(const cv::Mat &frame, const cv::Mat &roi, const cv::Point &origin, FrameScratch &scratch)
+{
+    LocAndConf a;
+    if (frame.depth() == DepthTraits<uchar>::depth && roi.depth() == DepthTraits<uchar>::depth)
+    {
+        match_kernel<uchar>(frame, roi, scratch);
+    } else
+    {
+        /* 16 bit, and any other depth, is matched as float */
+        match_kernel<uint16_t>(frame, roi, scratch);
+    }
+
+    /* Peak, PSR and secondary peak in one scan */
+    PeakScan scan(scratch.result.cols, scratch.result.rows, scratch.peak_blocks);
+    for (int y = 0; y < scratch.result.rows; y++)
+    {
+        const float *values = scratch.result.ptr<float>(y);
+        for (int x = 0; x < scratch.result.cols; x++)
+        {
+            scan.add(x, y, values[x]);
+        }
+    }
+    scan.finish(a);
+    const cv::Point maxLoc = a.match_loc;
+
+    // -ve value -> template moving up, +ve value -> template moving down
+    a.shift_row = maxLoc.y - origin.y;
+
+    // -ve value -> template moving left, +ve value -> template moving right
+    a.shift_col = maxLoc.x - origin.x;
+    return a;
+}
+
+PeakScan::PeakScan(int cols, int rows, std::vector<Block> &blocks)
+    : blocks(blocks), cols(cols), rows(rows), blocks_x((cols + block - 1) / block), blocks_y((rows + block - 1) / block)
+{
+    blocks.assign(static_cast<size_t>(blocks_x) * blocks_y, {-std::numeric_limits<double>::infinity(), 0.0, 0.0});
+}
+
+void PeakScan::finish(LocAndConf &a) const
+{
+    a.match_loc = max_loc;
+    a.confidence = max_value * 100;
+
+    /* Blocks touching the exclusion zone around the maximum belong to the peak */
+    const int first_bx = std::max(0, max_loc.x - exclusion) / block, last_bx = (max_loc.x + exclusion) / block;
+    const int first_by = std::max(0, max_loc.y - exclusion) / block, last_by = (max_loc.y + exclusion) / block;
+
+    double side_sum = 0, side_sq_sum = 0, secondary = -std::numeric_limits<double>::infinity();
+    double side_count = 0;
+    for (int by = 0; by < blocks_y; by++)
+    {
+        for (int bx = 0; bx < blocks_x; bx++)
+        {
+            if (bx >= first_bx && bx <= last_bx && by >= first_by && by <= last_by)
+            {
+                continue;
+            }
+            const Block &b = blocks[static_cast<size_t>(by) * blocks_x + bx];
+            side_sum += b.sum;
+            side_sq_sum += b.sq_sum;
+            secondary = std::max(secondary, b.max);
+
+            /* Blocks at the right and bottom edge may be cut */
+            side_count += std::min(block, cols - bx * block) * std::min(block, rows - by * block);
+        }
+    }
+    if (side_count < 2)
+    {
+        return;
+    }
+
+    double side_mean = side_sum / side_count;
+    double side_std = std::sqrt(std::max(0.0, (side_sq_sum - side_sum * side_mean) / (side_count - 1)));
+    a.psr = side_std > 0 ? (max_value - side_mean) / side_std : std::numeric_limits<double>::quiet_NaN();
+    a.peak_ratio = max_value > 0 ? secondary / max_value : std::numeric_limits<double>::quiet_NaN();
+}
+
+HOT_KERNEL double frame_change(const cv::Mat &frame, int bits, const cv::Rect &area, std::vector<float> &grid, const std::vector<float> &previous)
+{
+    const int step = 8;
+    const int lanes = 16;
+    const bool wide = frame.depth() == CV_16U;
+
+    /* The grid is sized once, every sample has its slot, so the loops have no push_back to serialize them */
+    const int grid_cols = (area.width + step - 1) / step, grid_rows = (area.height + step - 1) / step;
+    grid.resize(static_cast<size_t>(grid_cols) * grid_rows);
+    for (int gy = 0; gy < grid_rows; gy++)
+    {
+        const uchar *row = frame.ptr<uchar>(area.y + gy * step);
+        float *samples = grid.data() + static_cast<size_t>(gy) * grid_cols;
+        if (wide)
+        {
+            const uint16_t *pixels = reinterpret_cast<const uint16_t *>(row) + area.x;
+            for (int gx = 0; gx < grid_cols; gx++)
+            {
+                samples[gx] = pixels[gx * step];
+            }
+        } else
+        {
+            const uchar *pixels = row + area.x;
+            for (int gx = 0; gx < grid_cols; gx++)
+            {
+                samples[gx] = pixels[gx * step];
+            }
+        }
+    }
+    if (grid.empty() || grid.size() != previous.size())
+    {
+        return std::numeric_limits<double>::infinity();
+    }
+
+    /* One float partial sum per vector lane, like mig_kernel() */
+    const size_t count = grid.size();
+    float partial[lanes] = {};
+    size_t i = 0;
+    for (; i + lanes <= count; i += lanes)
+    {
+        for (int j = 0; j < lanes; j++)
+        {
+            partial[j] += std::abs(grid[i + j] - previous[i + j]);
+        }
+    }
+    double sum = 0;
+    for (; i < count; i++)
+    {
+        sum += std::abs(grid[i] - previous[i]);
+    }
+    for (int j = 0; j < lanes; j++)
+    {
+        sum += partial[j];
+    }
+    /* Full scale of the pixels to 255 */
+    return sum / count * (255.0 / ((1 << bits) - 1));
+}
+
+bool forward_backward_consistent(const cv::Mat &frame, const LocAndConf &forward, const Experiment &exp, const Experiment::RoiOutput &output, FrameScratch &scratch)
+{
+    const RoiConfig &config = output.config;
+    const cv::Rect patch_rect(forward.match_loc.x, forward.match_loc.y, config.w, config.h);
+    if ((patch_rect & cv::Rect(0, 0, frame.cols, frame.rows)).area() != patch_rect.area())
+    {
+        return false;
+    }
+
+    cv::Point backward;
+    if (output.window.area() * 2 < exp.reference.size.area())
+    {
+        /* Small window: matching in frame_0 (the float frame in the top left of its padded copy) within the window */
+        frame(patch_rect).convertTo(scratch.patch_padded, CV_32F);
+        cv::matchTemplate(exp.reference.padded(output.window), scratch.patch_padded, scratch.result, cv::TM_CCORR_NORMED, cv::Mat());
+        cv::minMaxLoc(scratch.result, nullptr, nullptr, nullptr, &backward, cv::Mat());
+        backward += output.window.tl();
+    } else
+    {
+        template_spectrum(frame(patch_rect), exp.reference.size, scratch.patch_padded, scratch.patch);
+        backward = match_spectral(exp.reference, scratch.patch, config.w, config.h, output.window, config.tl(), scratch).match_loc;
+    }
+    return std::abs(backward.x - config.x) <= settings.consistency_tolerance && std::abs(backward.y - config.y) <= settings.consistency_tolerance;
+}
+
+cv::Rect tracking_window(const RoiConfig &config, const ShiftFilter &tracker, const cv::Size &frame_size)
+{
+    const cv::Rect frame_rect(0, 0, frame_size.width, frame_size.height);
+    if (!tracker.started)
+    {
+        return frame_rect;
+    }
+
+    /* Top left corner of the RoI at the predicted shift, which get_results() measures from the RoI */
+    const int margin = settings.search_margin;
+    int x = static_cast<int>(std::lround(tracker.x.p + tracker.x.v)) + config.x;
+    int y = static_cast<int>(std::lround(tracker.y.p + tracker.y.v)) + config.y;
+    return cv::Rect(x - margin, y - margin, config.w + 2 * margin, config.h + 2 * margin) & frame_rect;
+}
+
+cv::Rect track_chunk(Experiment &exp, size_t begin, size_t end, std::vector<ShiftFilter> &trackers)
+{
+    size_t unwritten = 0;
+    {
+        std::lock_guard<std::mutex> lock(exp.write_mutex);
+        trackers.clear();
+        for (const auto &output: exp.outputs)
+        {
+            trackers.push_back(output.filter);
+        }
+        unwritten = begin > exp.next_frame ? begin - exp.next_frame : 0;
+    }
+
+    const cv::Rect frame_rect(0, 0, exp.frame_size.width, exp.frame_size.height);
+    bool bounded = exp.source->random_access() && end > begin;
+    for (auto &tracker: trackers)
+    {
+        for (size_t i = 0; i < unwritten; i++)
+        {
+            tracker.coast(settings.kalman_q);
+        }
+        bounded = bounded && tracker.started;
+    }
+    if (!bounded)
+    {
+        return frame_rect;
+    }
+
+    cv::Rect active;
+    for (size_t c = 0; c < trackers.size(); c++)
+    {
+        const RoiConfig &config = exp.outputs[c].config;
+        ShiftFilter last = trackers[c];
+        for (size_t i = begin + 1; i < end; i++)
+        {
+            last.coast(settings.kalman_q);
+        }
+        const int spread = static_cast<int>(std::ceil(3 * std::sqrt(std::max(last.x.p00, last.y.p00))));
+        cv::Rect reach = tracking_window(config, trackers[c], exp.frame_size) | tracking_window(config, last, exp.frame_size);
+        reach = cv::Rect(reach.x - spread, reach.y - spread, reach.width + 2 * spread, reach.height + 2 * spread) & frame_rect;
+        active = active.empty() ? reach : (active | reach);
+    }
+    return active;
+}
+
+cv::Rect search_window(const RoiConfig &config, const cv::Size &frame_size)
+{
+    const cv::Rect frame_rect(0, 0, frame_size.width, frame_size.height);
+    if (settings.search_margin < 0)
+    {
+        return frame_rect;
+    }
+    const int margin = settings.search_margin;
+    return cv::Rect(config.x - margin, config.y - margin, config.w + 2 * margin, config.h + 2 * margin) & frame_rect;
+}
+
+cv::Size get_dft_size(const cv::Size &frame_size)
+{
+    return cv::Size(cv::getOptimalDFTSize(frame_size.width), cv::getOptimalDFTSize(frame_size.height));
+}
+
+void frame_spectrum(const cv::Mat &frame, FrameSpectrum &spectrum)
+{
+    spectrum.size = frame.size();
+    cv::Size dft_size = get_dft_size(frame.size());
+    spectrum.padded.create(dft_size);
+
+    /* Frame in the top left corner, zeros right of and below it */
+    cv::Mat1f inner = spectrum.padded(cv::Rect(0, 0, frame.cols, frame.rows));
+    frame.convertTo(inner, CV_32F);
+    if (dft_size.width > frame.cols)
+    {
+        spectrum.padded(cv::Rect(frame.cols, 0, dft_size.width - frame.cols, frame.rows)).setTo(0);
+    }
+    if (dft_size.height > frame.rows)
+    {
+        spectrum.padded(cv::Rect(0, frame.rows, dft_size.width, dft_size.height - frame.rows)).setTo(0);
+    }
+
+    cv::dft(spectrum.padded, spectrum.spectrum, 0, frame.rows);
+    cv::integral(inner, spectrum.sum, spectrum.sq_sum, CV_64F, CV_64F);
+}
+
+void template_spectrum(const cv::Mat &roi, const cv::Size &frame_size, cv::Mat1f &padded, TemplateSpectrum &roi_spectrum)
+{
+    padded.create(get_dft_size(frame_size));
+    padded.setTo(0);
+    cv::Mat1f inner = padded(cv::Rect(0, 0, roi.cols, roi.rows));
+    roi.convertTo(inner, CV_32F);
+    roi_spectrum.norm = cv::norm(inner, cv::NORM_L2);
+    cv::dft(padded, roi_spectrum.spectrum, 0, roi.rows);
+}
+
+LocAndConf match_spectral(const FrameSpectrum &frame, const TemplateSpectrum &roi_spectrum, const int &width, const int &height, const cv::Rect &window, const cv::Point &origin, FrameScratch &scratch)
+{
+    LocAndConf a;
+    const int result_rows = window.y + window.height - height + 1;
+    const int result_cols = window.x + window.width - width + 1;
+
+    /* Cross correlation for every RoI position, only the rows of valid positions are transformed back */
+    cv::mulSpectrums(frame.spectrum, roi_spectrum.spectrum, scratch.product, 0, true);
+    cv::dft(scratch.product, scratch.correlation, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT, result_rows);
+
+    /* Normalizing by the energy of the window under the RoI, in the same scan that finds the peak */
+    PeakScan scan(result_cols - window.x, result_rows - window.y, scratch.peak_blocks);
+    for (int y = window.y; y < result_rows; y++)
+    {
+        const float *correlation = scratch.correlation.ptr<float>(y);
+        const double *top = frame.sq_sum.ptr<double>(y);
+        const double *bottom = frame.sq_sum.ptr<double>(y + height);
+        for (int x = window.x; x < result_cols; x++)
+        {
+            double energy = bottom[x + width] - bottom[x] - top[x + width] + top[x];
+            double denominator = std::sqrt(std::max(energy, 0.0)) * roi_spectrum.norm;
+            double value = denominator > 0 ? std::min(correlation[x] / denominator, 1.0) : 0.0;
+            scan.add(x - window.x, y - window.y, value);
+        }
+    }
+    scan.finish(a);
+    a.match_loc += window.tl();
+    const cv::Point maxLoc = a.match_loc;
+
+    // -ve value -> template moving up, +ve value -> template moving down
+    a.shift_row = maxLoc.y - origin.y;
+
+    // -ve value -> template moving left, +ve value -> template moving right
+    a.shift_col = maxLoc.x - origin.x;
     return a;
-}
\ No newline at end of file
+}
+
+bool read_file(const std::string &path, std::vector<uchar> &bytes)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+    {
+        return false;
+    }
+    std::streamsize size = file.tellg();
+    file.seekg(0, std::ios::beg);
+    bytes.resize(static_cast<size_t>(size));
+    return static_cast<bool>(file.read(reinterpret_cast<char *>(bytes.data()), size));
+}
+
+IoThreadPool &io_thread_pool()
+{
+    static IoThreadPool pool(settings.io_threads);
+    return pool;
+}
+
+IoThreadPool::IoThreadPool(unsigned num_threads)
+{
+    for (unsigned i = 0; i < num_threads; i++)
+    {
+        threads.emplace_back([this]()
+        {
+            /* Reader threads only read frame files */
+            MemoryScope decode_scope(MemoryStage::Decode);
+            while (true)
+            {
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                    if (jobs.empty())
+                    {
+                        return;
+                    }
+                    job = std::move(jobs.front());
+                    jobs.pop_front();
+                }
+                job();
+            }
+        });
+    }
+}
+
+IoThreadPool::~IoThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &thread: threads)
+    {
+        thread.join();
+    }
+}
+
+void IoThreadPool::enqueue(std::function<void()> job)
+{
+    MemoryScope queue_scope(MemoryStage::Queues);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    wake.notify_one();
+}
+
+FramePrefetcher::FramePrefetcher(unsigned depth) : slots(depth)
+{
+#ifdef HAVE_LIBURING
+    use_uring = (io_uring_queue_init(depth, &ring, 0) == 0);
+#endif
+}
+
+FramePrefetcher::~FramePrefetcher()
+{
+    /* Waiting for reads still in flight, they write into our slots */
+    std::vector<uchar> discard;
+    while (next_consume < next_issue)
+    {
+        next(discard);
+    }
+#ifdef HAVE_LIBURING
+    if (use_uring)
+    {
+        io_uring_queue_exit(&ring);
+    }
+#endif
+}
+
+void FramePrefetcher::start(const std::vector<std::string> &paths)
+{
+    this->paths = paths;
+    next_issue = 0;
+    next_consume = 0;
+    while (next_issue < paths.size() && next_issue < slots.size())
+    {
+        issue();
+    }
+}
+
+bool FramePrefetcher::next(std::vector<uchar> &bytes)
+{
+    if (next_consume >= next_issue)
+    {
+        return false;
+    }
+    Slot &slot = slots[next_consume % slots.size()];
+
+#ifdef HAVE_LIBURING
+    while (use_uring && !slot.ready)
+    {
+        reap();
+    }
+#endif
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [&slot]() { return slot.ready; });
+    }
+
+    bool ok = slot.ok;
+    bytes.swap(slot.bytes);
+    next_consume++;
+
+    /* The slot is free again, reading the next file into it */
+    if (next_issue < paths.size())
+    {
+        issue();
+    }
+    return ok;
+}
+
+void FramePrefetcher::issue()
+{
+    size_t slot_id = next_issue % slots.size();
+    Slot &slot = slots[slot_id];
+    const std::string &path = paths[next_issue];
+    next_issue++;
+    slot.ready = false;
+    slot.ok = false;
+    slot.done_bytes = 0;
+
+#ifdef HAVE_LIBURING
+    if (use_uring)
+    {
+        struct stat file_stat;
+        slot.fd = open(path.c_str(), O_RDONLY);
+        if (slot.fd < 0 || fstat(slot.fd, &file_stat) != 0)
+        {
+            finish(slot, false);
+            return;
+        }
+        slot.bytes.resize(static_cast<size_t>(file_stat.st_size));
+        if (slot.bytes.empty())
+        {
+            finish(slot, true);
+            return;
+        }
+        submit_read(slot_id);
+        return;
+    }
+#endif
+
+    /* Sized here like for io_uring, so that a slot that grows is allocated and first touched by the (pinned) worker
+       and not by an unpinned reader thread. The reader only fills it. */
+    struct stat file_stat;
+    if (stat(path.c_str(), &file_stat) != 0)
+    {
+        finish(slot, false);
+        return;
+    }
+    slot.bytes.resize(static_cast<size_t>(file_stat.st_size));
+    if (slot.bytes.empty())
+    {
+        finish(slot, true);
+        return;
+    }
+
+    io_thread_pool().enqueue([this, &slot, path]()
+    {
+        std::ifstream file(path, std::ios::binary);
+        bool ok = static_cast<bool>(file.read(reinterpret_cast<char *>(slot.bytes.data()), static_cast<std::streamsize>(slot.bytes.size())));
+        std::lock_guard<std::mutex> lock(mutex);
+        slot.ok = ok;
+        slot.ready = true;
+        ready.notify_one();
+    });
+}
+
+void FramePrefetcher::finish(Slot &slot, bool ok)
+{
+    if (slot.fd >= 0)
+    {
+        close(slot.fd);
+        slot.fd = -1;
+    }
+    slot.ok = ok;
+    slot.ready = true;
+}
+
+#ifdef HAVE_LIBURING
+void FramePrefetcher::submit_read(size_t slot_id)
+{
+    Slot &slot = slots[slot_id];
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+    io_uring_prep_read(sqe, slot.fd, slot.bytes.data() + slot.done_bytes, static_cast<unsigned>(slot.bytes.size() - slot.done_bytes), slot.done_bytes);
+    io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(slot_id));
+    io_uring_submit(&ring);
+}
+
+void FramePrefetcher::reap()
+{
+    struct io_uring_cqe *cqe;
+    if (io_uring_wait_cqe(&ring, &cqe) != 0)
+    {
+        return;
+    }
+    size_t slot_id = reinterpret_cast<size_t>(io_uring_cqe_get_data(cqe));
+    int res = cqe->res;
+    io_uring_cqe_seen(&ring, cqe);
+
+    Slot &slot = slots[slot_id];
+    if (res <= 0)
+    {
+        finish(slot, false);
+        return;
+    }
+
+    /* Short reads are continued where they stopped */
+    slot.done_bytes += static_cast<size_t>(res);
+    if (slot.done_bytes < slot.bytes.size())
+    {
+        submit_read(slot_id);
+    } else
+    {
+        finish(slot, true);
+    }
+}
+#endif
+
+PackedFrameFile::~PackedFrameFile()
+{
+    close();
+}
+
+void PackedFrameFile::close()
+{
+    if (base != nullptr)
+    {
+        munmap(base, mapped_size);
+        base = nullptr;
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool PackedFrameFile::map(const std::string &path)
+{
+    struct stat file_stat;
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0 || fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+    {
+        return false;
+    }
+    mapped_size = static_cast<size_t>(file_stat.st_size);
+    void *mapping = mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+    base = static_cast<uchar *>(mapping);
+    madvise(base, mapped_size, MADV_SEQUENTIAL);
+    return true;
+}
+
+bool PackedFrameFile::open_raw(const std::string &path, size_t frame_bytes)
+{
+    if (!map(path) || frame_bytes == 0 || mapped_size % frame_bytes != 0)
+    {
+        return false;
+    }
+    for (size_t offset = 0; offset < mapped_size; offset += frame_bytes)
+    {
+        offsets.push_back(offset);
+        sizes.push_back(frame_bytes);
+    }
+    return true;
+}
+
+bool PackedFrameFile::open(const std::string &path)
+{
+    if (!map(path) || mapped_size < 16)
+    {
+        return false;
+    }
+
+    uint32_t count;
+    std::memcpy(&count, base + 8, sizeof(count));
+    if (std::memcmp(base, magic, 8) != 0 || 16 + static_cast<size_t>(count) * 16 > mapped_size)
+    {
+        return false;
+    }
+
+    offsets.resize(count);
+    sizes.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        std::memcpy(&offsets[i], base + 16 + i * 16, sizeof(uint64_t));
+        std::memcpy(&sizes[i], base + 24 + i * 16, sizeof(uint64_t));
+        if (offsets[i] + sizes[i] > mapped_size)
+        {
+            offsets.clear();
+            sizes.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+void PackedFrameFile::will_need(size_t begin, size_t end) const
+{
+    end = std::min(end, frame_count());
+    if (begin >= end)
+    {
+        return;
+    }
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t first = (offsets[begin] / page) * page;
+    size_t last = offsets[end - 1] + sizes[end - 1];
+    madvise(base + first, last - first, MADV_WILLNEED);
+}
+
+void PackedFrameFile::release(size_t frame) const
+{
+    /* Only pages that lie completely inside this frame, the neighbours may still be decoded by other workers */
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t first = ((offsets[frame] + page - 1) / page) * page;
+    size_t last = ((offsets[frame] + sizes[frame]) / page) * page;
+    if (first < last)
+    {
+        madvise(base + first, last - first, MADV_DONTNEED);
+        posix_fadvise(fd, static_cast<off_t>(first), static_cast<off_t>(last - first), POSIX_FADV_DONTNEED);
+    }
+}
+
+bool write_frame_pack(const std::string &pack_path, const std::vector<std::string> &frame_paths)
+{
+    /* Writing to a temporary file first, so that an interrupted run never leaves a truncated container behind */
+    std::string tmp_path = pack_path + ".tmp";
+    std::ofstream pack_file(tmp_path, std::ios::binary);
+    if (!pack_file.is_open())
+    {
+        return false;
+    }
+
+    uint32_t count = static_cast<uint32_t>(frame_paths.size());
+    uint32_t reserved = 0;
+    pack_file.write(PackedFrameFile::magic, 8);
+    pack_file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    pack_file.write(reinterpret_cast<const char *>(&reserved), sizeof(reserved));
+
+    /* The index is written after the frames, once their sizes are known */
+    std::vector<uint64_t> index(2 * frame_paths.size());
+    pack_file.write(reinterpret_cast<const char *>(index.data()), static_cast<std::streamsize>(index.size() * sizeof(uint64_t)));
+
+    std::vector<uchar> bytes;
+    for (size_t i = 0; i < frame_paths.size(); i++)
+    {
+        if (!read_file(frame_paths[i], bytes))
+        {
+            pack_file.close();
+            std::filesystem::remove(tmp_path);
+            return false;
+        }
+        index[2 * i] = static_cast<uint64_t>(pack_file.tellp());
+        index[2 * i + 1] = bytes.size();
+        pack_file.write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    }
+
+    pack_file.seekp(16);
+    pack_file.write(reinterpret_cast<const char *>(index.data()), static_cast<std::streamsize>(index.size() * sizeof(uint64_t)));
+    pack_file.close();
+    if (!pack_file)
+    {
+        std::filesystem::remove(tmp_path);
+        return false;
+    }
+    std::filesystem::rename(tmp_path, pack_path);
+    return true;
+}
+
+bool open_frame_cache(const std::string &path, FrameCache &cache)
+{
+    std::ifstream in(path, std::ios::binary);
+    char magic[8];
+    bool valid = in.read(magic, 8) && std::memcmp(magic, FrameCache::magic, 8) == 0;
+    size_t records = 0;
+    if (valid)
+    {
+        uint64_t key;
+        double mig;
+        while (in.read(reinterpret_cast<char *>(&key), sizeof(key)) && in.read(reinterpret_cast<char *>(&mig), sizeof(mig)))
+        {
+            cache.mig[key] = mig;
+            records++;
+        }
+    }
+    in.close();
+
+    /* A missing or foreign file is started over, a valid one is appended to */
+    cache.path = path;
+    if (!valid)
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(FrameCache::magic, 8);
+        return out.is_open() && static_cast<bool>(out);
+    }
+
+    /* Appending after the last complete record, so that a truncated one does not shift every later record */
+    std::error_code error;
+    std::filesystem::resize_file(path, 8 + records * (sizeof(uint64_t) + sizeof(double)), error);
+    return !error;
+}
+
+uint64_t frame_cache_key(const cv::Mat &frame)
+{
+    /* Bump when mig_kernel() changes its results */
+    const uint64_t mig_version = 1;
+
+    auto mix = [](uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ull;
+        h ^= h >> 33;
+        return h;
+    };
+
+    uint64_t hash = mix((mig_version << 48) ^ (static_cast<uint64_t>(frame.depth()) << 40) ^ (static_cast<uint64_t>(frame.rows) << 20) ^ static_cast<uint64_t>(frame.cols));
+    const size_t row_bytes = static_cast<size_t>(frame.cols) * frame.elemSize();
+    for (int y = 0; y < frame.rows; y++)
+    {
+        const uchar *p = frame.ptr<uchar>(y);
+        size_t i = 0;
+        for (; i + 8 <= row_bytes; i += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, p + i, 8);
+            hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+            hash ^= hash >> 29;
+        }
+        uint64_t tail = 0;
+        std::memcpy(&tail, p + i, row_bytes - i);
+        hash = (hash ^ tail ^ (static_cast<uint64_t>(y) << 56)) * 0x9E3779B97F4A7C15ull;
+    }
+    hash = mix(hash);
+    return hash != 0 ? hash : 1;
+}
+
+std::unique_ptr<FrameSource> open_frame_source(const std::string &exp_dir, const std::vector<std::string> &file_names)
+{
+    std::string shm_marker = exp_dir + "/frames.shm";
+    if (std::filesystem::exists(shm_marker))
+    {
+        std::ifstream marker_file(shm_marker);
+        std::string shm_name;
+        std::getline(marker_file, shm_name);
+        auto source = std::make_unique<ShmRingSource>(shm_name);
+        if (source->open())
+        {
+            return source;
+        }
+        std::cerr << "/// Error opening shared memory ring  :       " << shm_name << std::endl;
+    }
+
+    const std::pair<const char *, PixelFormat> containers[] = {{"/frames.pack", PixelFormat::Encoded},
+                                                               {"/frames.mono8", PixelFormat::Mono8},
+                                                               {"/frames.mono12p", PixelFormat::Mono12p}};
+    for (const auto &container: containers)
+    {
+        std::string pack_path = exp_dir + container.first;
+        if (std::filesystem::exists(pack_path))
+        {
+            auto source = std::make_unique<PackedFrameSource>(pack_path, container.second);
+            if (source->open())
+            {
+                return source;
+            }
+            std::cerr << "/// Error opening frame container     :       " << pack_path << std::endl;
+        }
+    }
+
+    for (const char *extension: {".avi", ".mp4", ".mkv"})
+    {
+        std::string video_path = exp_dir + "/frames" + extension;
+        if (std::filesystem::exists(video_path))
+        {
+            auto source = std::make_unique<VideoFrameSource>(video_path);
+            if (source->open())
+            {
+                return source;
+            }
+            std::cerr << "/// Error opening video               :       " << video_path << std::endl;
+        }
+    }
+
+    return std::make_unique<FileTreeSource>(exp_dir, file_names);
+}
+
+int FrameView::significant_bits(const cv::Mat &frame) const
+{
+    return format == PixelFormat::Mono12p ? 12 : 8 * static_cast<int>(frame.elemSize1());
+}
+
+cv::Mat decode_frame(const FrameView &view, int row_limit, FrameScratch &scratch)
+{
+    if (!view.ok)
+    {
+        return cv::Mat();
+    }
+    if (view.data == nullptr)
+    {
+        return view.pixels.rowRange(0, std::min(row_limit, view.pixels.rows));
+    }
+    return decode_bytes(view.data, view.size, view.format, row_limit, scratch.frame16, scratch.frame);
+}
+
+#ifdef HAVE_LIBPNG
+/*
+* Decodes the first 'row_limit' rows of a non-interlaced grayscale PNG with libpng. PNG rows are filtered against the
+* row above, so decoding has to start at the top, but it stops as soon as the last needed row is out. Returns the
+* number of decoded rows, 0 if the PNG needs what only cv::imdecode() does (color, transparency, interlacing) or is
+* broken. Keeps to plain data between setjmp() and a possible longjmp() from libpng.
+*/
+static int decode_png_rows(const uchar *data, size_t size, int row_limit, cv::Mat &decoded)
+{
+    struct PngInput
+    {
+        const uchar *data;
+        size_t size, offset;
+    } input = {data, size, 0};
+
+    if (size < 8 || png_sig_cmp(data, 0, 8) != 0)
+    {
+        return 0;
+    }
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, [](png_structp, png_const_charp) {});
+    png_infop info = png ? png_create_info_struct(png) : nullptr;
+    if (info == nullptr)
+    {
+        png_destroy_read_struct(&png, nullptr, nullptr);
+        return 0;
+    }
+    if (setjmp(png_jmpbuf(png)))
+    {
+        png_destroy_read_struct(&png, &info, nullptr);
+        return 0;
+    }
+
+    png_set_read_fn(png, &input, [](png_structp png_ptr, png_bytep out, png_size_t length)
+    {
+        PngInput *in = static_cast<PngInput *>(png_get_io_ptr(png_ptr));
+        if (in->size - in->offset < length)
+        {
+            png_error(png_ptr, "truncated PNG");
+        }
+        std::memcpy(out, in->data + in->offset, length);
+        in->offset += length;
+    });
+    png_read_info(png, info);
+
+    png_uint_32 width, height;
+    int bit_depth, color_type, interlace;
+    png_get_IHDR(png, info, &width, &height, &bit_depth, &color_type, &interlace, nullptr, nullptr);
+    if (color_type != PNG_COLOR_TYPE_GRAY || interlace != PNG_INTERLACE_NONE || png_get_valid(png, info, PNG_INFO_tRNS))
+    {
+        png_destroy_read_struct(&png, &info, nullptr);
+        return 0;
+    }
+
+    /* Same depth handling as cv::imdecode(): low depths expanded to 8 bit, 16 bit kept unless --png-8bit */
+    int depth = CV_8U;
+    if (bit_depth < 8)
+    {
+        png_set_expand_gray_1_2_4_to_8(png);
+    } else if (bit_depth == 16 && settings.png_8bit)
+    {
+        png_set_strip_16(png);
+    } else if (bit_depth == 16)
+    {
+        /* PNG stores 16 bit samples big endian */
+        png_set_swap(png);
+        depth = CV_16U;
+    }
+    png_read_update_info(png, info);
+
+    decoded.create(static_cast<int>(height), static_cast<int>(width), CV_MAKETYPE(depth, 1));
+    const int rows = std::min(row_limit, static_cast<int>(height));
+    for (int y = 0; y < rows; y++)
+    {
+        png_read_row(png, decoded.ptr<uchar>(y), nullptr);
+    }
+    png_destroy_read_struct(&png, &info, nullptr);
+    return rows;
+}
+#endif
+
+cv::Mat decode_bytes(const uchar *data, size_t size, PixelFormat format, int row_limit, cv::Mat &unpacked, cv::Mat &decoded)
+{
+    const size_t num_pixels = static_cast<size_t>(frameWidth) * frameHeight;
+    const int rows = std::min(row_limit, frameHeight);
+    switch (format)
+    {
+    case PixelFormat::Mono8:
+        if (size != num_pixels)
+        {
+            return cv::Mat();
+        }
+        return cv::Mat(rows, frameWidth, CV_8UC1, const_cast<uchar *>(data));
+
+    case PixelFormat::Mono12p:
+        if (size != num_pixels * 3 / 2)
+        {
+            return cv::Mat();
+        }
+        unpacked.create(frameHeight, frameWidth, CV_16UC1);
+        unpack_mono12p(data, unpacked.ptr<uint16_t>(), static_cast<size_t>(rows) * frameWidth);
+        return unpacked.rowRange(0, rows);
+
+    case PixelFormat::Encoded:
+        break;
+    }
+
+#ifdef HAVE_LIBPNG
+    /* Stopping after the needed rows only pays when there are rows to skip */
+    if (row_limit < frameHeight)
+    {
+        int decoded_rows = decode_png_rows(data, size, row_limit, decoded);
+        if (decoded_rows > 0)
+        {
+            return decoded.rowRange(0, decoded_rows);
+        }
+    }
+#endif
+
+    /* IMREAD_GRAYSCALE alone would reduce 16 bit PNGs to 8 bit */
+    const int flags = settings.png_8bit ? cv::IMREAD_GRAYSCALE : (cv::IMREAD_GRAYSCALE | cv::IMREAD_ANYDEPTH);
+    cv::Mat encoded(1, static_cast<int>(size), CV_8UC1, const_cast<uchar *>(data));
+    if (cv::imdecode(encoded, flags, &decoded).empty())
+    {
+        return cv::Mat();
+    }
+    return decoded.rowRange(0, std::min(row_limit, decoded.rows));
+}
+
+PixelFormat raw_format_from_size(size_t size)
+{
+    const size_t num_pixels = static_cast<size_t>(frameWidth) * frameHeight;
+    if (size == num_pixels)
+    {
+        return PixelFormat::Mono8;
+    }
+    if (size == num_pixels * 3 / 2)
+    {
+        return PixelFormat::Mono12p;
+    }
+    return PixelFormat::Encoded;
+}
+
+/* Scalar unpacking of 'num_pixels' Mono12p pixels, also used for the tail of the SIMD versions */
+static void unpack_mono12p_scalar(const uchar *src, uint16_t *dst, size_t num_pixels)
+{
+    for (size_t i = 0; i + 1 < num_pixels; i += 2, src += 3)
+    {
+        dst[i] = static_cast<uint16_t>(src[0] | ((src[1] & 0x0F) << 8));
+        dst[i + 1] = static_cast<uint16_t>((src[1] >> 4) | (src[2] << 4));
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+* Every 3 packed bytes hold 2 pixels. A byte shuffle copies bytes (b0, b1) into the 16 bit lane of the even pixel and
+* (b1, b2) into the lane of the odd pixel, then even lanes are masked to 12 bits and odd lanes shifted right by 4.
+* Each 128 bit lane consumes 12 bytes and produces 8 pixels. Loads are 16 bytes wide, so the loop stops while at
+* least 4 bytes of input remain and leaves the rest to the scalar version.
+*/
+__attribute__((target("ssse3"))) static void unpack_mono12p_ssse3(const uchar *src, uint16_t *dst, size_t num_pixels)
+{
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+    const __m128i even_mask = _mm_set1_epi32(0x00000FFF);
+    const __m128i odd_mask = _mm_set1_epi32(static_cast<int>(0xFFFF0000));
+    size_t i = 0;
+    for (; (i + 8) / 2 * 3 + 4 <= num_pixels / 2 * 3; i += 8)
+    {
+        __m128i packed = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i / 2 * 3)), shuffle);
+        __m128i even = _mm_and_si128(packed, even_mask);
+        __m128i odd = _mm_and_si128(_mm_srli_epi16(packed, 4), odd_mask);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_or_si128(even, odd));
+    }
+    unpack_mono12p_scalar(src + i / 2 * 3, dst + i, num_pixels - i);
+}
+
+__attribute__((target("avx2"))) static void unpack_mono12p_avx2(const uchar *src, uint16_t *dst, size_t num_pixels)
+{
+    const __m256i shuffle = _mm256_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11,
+                                             0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+    const __m256i even_mask = _mm256_set1_epi32(0x00000FFF);
+    const __m256i odd_mask = _mm256_set1_epi32(static_cast<int>(0xFFFF0000));
+    size_t i = 0;
+    for (; (i + 16) / 2 * 3 + 4 <= num_pixels / 2 * 3; i += 16)
+    {
+        const uchar *group = src + i / 2 * 3;
+        __m256i loaded = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(group))),
+                                                 _mm_loadu_si128(reinterpret_cast<const __m128i *>(group + 12)), 1);
+        __m256i packed = _mm256_shuffle_epi8(loaded, shuffle);
+        __m256i even = _mm256_and_si256(packed, even_mask);
+        __m256i odd = _mm256_and_si256(_mm256_srli_epi16(packed, 4), odd_mask);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_or_si256(even, odd));
+    }
+    unpack_mono12p_scalar(src + i / 2 * 3, dst + i, num_pixels - i);
+}
+#endif
+
+void unpack_mono12p(const uchar *src, uint16_t *dst, size_t num_pixels)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    static const bool has_ssse3 = __builtin_cpu_supports("ssse3");
+    if (has_avx2)
+    {
+        unpack_mono12p_avx2(src, dst, num_pixels);
+        return;
+    }
+    if (has_ssse3)
+    {
+        unpack_mono12p_ssse3(src, dst, num_pixels);
+        return;
+    }
+#endif
+    unpack_mono12p_scalar(src, dst, num_pixels);
+}
+
+std::string FrameSource::frame_name(size_t index) const
+{
+    return describe() + " #" + std::to_string(index);
+}
+
+void FrameSource::begin_range(size_t, size_t, size_t, FrameScratch &)
+{
+}
+
+void FrameSource::release(size_t)
+{
+}
+
+FrameRange FrameSource::range(size_t begin, size_t end, size_t step, FrameScratch &scratch)
+{
+    return FrameRange(*this, begin, end, step, scratch);
+}
+
+FrameRange::FrameRange(FrameSource &source, size_t begin, size_t end, size_t step, FrameScratch &scratch) : source(source), scratch(scratch), end_index(end), step(step)
+{
+    if (begin >= end)
+    {
+        done = true;
+        return;
+    }
+    source.begin_range(begin, end, step, scratch);
+    read(begin);
+}
+
+void FrameRange::read(size_t index)
+{
+    view = FrameView();
+    view.index = index;
+    FrameStatus status = source.read(index, scratch, view);
+    view.ok = (status == FrameStatus::Ok);
+    done = (status == FrameStatus::End);
+}
+
+void FrameRange::advance()
+{
+    source.release(view.index);
+    if (view.index + step >= end_index)
+    {
+        done = true;
+        return;
+    }
+    read(view.index + step);
+}
+
+FileTreeSource::FileTreeSource(const std::string &exp_dir, const std::vector<std::string> &file_names)
+{
+    for (const auto &file_name: file_names)
+    {
+        paths.push_back(exp_dir + "/" + file_name);
+    }
+}
+
+cv::Mat FileTreeSource::first_frame()
+{
+    std::vector<uchar> bytes;
+    cv::Mat unpacked, decoded;
+    if (paths.empty() || !read_file(paths[0], bytes))
+    {
+        return cv::Mat();
+    }
+    PixelFormat format = (std::filesystem::path(paths[0]).extension() == ".raw") ? raw_format_from_size(bytes.size()) : PixelFormat::Encoded;
+    return decode_bytes(bytes.data(), bytes.size(), format, frameHeight, unpacked, decoded).clone();
+}
+
+void FileTreeSource::begin_range(size_t begin, size_t end, size_t step, FrameScratch &scratch)
+{
+    if (scratch.prefetcher)
+    {
+        /* Only the files of the range are read ahead */
+        std::vector<std::string> range_paths;
+        for (size_t index = begin; index < end; index += step)
+        {
+            range_paths.push_back(paths[index]);
+        }
+        scratch.prefetcher->start(range_paths);
+    }
+}
+
+FrameStatus FileTreeSource::read(size_t index, FrameScratch &scratch, FrameView &view)
+{
+    bool ok = scratch.prefetcher ? scratch.prefetcher->next(scratch.file_bytes) : read_file(paths[index], scratch.file_bytes);
+    view.data = scratch.file_bytes.data();
+    view.size = scratch.file_bytes.size();
+    if (std::filesystem::path(paths[index]).extension() == ".raw")
+    {
+        view.format = raw_format_from_size(view.size);
+    }
+    return ok ? FrameStatus::Ok : FrameStatus::Unreadable;
+}
+
+bool PackedFrameSource::open()
+{
+    const size_t num_pixels = static_cast<size_t>(frameWidth) * frameHeight;
+    switch (format)
+    {
+    case PixelFormat::Mono8:
+        return pack.open_raw(pack_path, num_pixels);
+    case PixelFormat::Mono12p:
+        return pack.open_raw(pack_path, num_pixels * 3 / 2);
+    case PixelFormat::Encoded:
+        break;
+    }
+    return pack.open(pack_path);
+}
+
+cv::Mat PackedFrameSource::first_frame()
+{
+    cv::Mat unpacked, decoded;
+    if (pack.frame_count() == 0)
+    {
+        return cv::Mat();
+    }
+    return decode_bytes(pack.frame_data(0), pack.frame_size(0), format, frameHeight, unpacked, decoded).clone();
+}
+
+void PackedFrameSource::begin_range(size_t begin, size_t end, size_t step, FrameScratch &scratch)
+{
+    scratch.range_step = step;
+    if (step == 1)
+    {
+        pack.will_need(begin, std::min(end, begin + std::max(1u, settings.prefetch_depth)));
+        return;
+    }
+    for (size_t i = 0, index = begin; i < std::max(1u, settings.prefetch_depth) && index < end; i++, index += step)
+    {
+        pack.will_need(index, index + 1);
+    }
+}
+
+FrameStatus PackedFrameSource::read(size_t index, FrameScratch &scratch, FrameView &view)
+{
+    /* The frame 'prefetch_depth' frames of the range ahead is requested while this one is decoded */
+    size_t ahead = index + std::max(1u, settings.prefetch_depth) * scratch.range_step;
+    pack.will_need(ahead, ahead + 1);
+    view.format = format;
+    view.data = pack.frame_data(index);
+    view.size = pack.frame_size(index);
+    return FrameStatus::Ok;
+}
+
+size_t VideoFrameSource::frame_count() const
+{
+    double count = capture.get(cv::CAP_PROP_FRAME_COUNT);
+    return count > 0 ? static_cast<size_t>(count) : 0;
+}
+
+cv::Mat VideoFrameSource::first_frame()
+{
+    /* A second capture, so that the one used by the worker still starts at frame 0 */
+    cv::VideoCapture first_capture(video_path);
+    cv::Mat first, first_gray;
+    if (!first_capture.read(first))
+    {
+        return cv::Mat();
+    }
+    if (first.channels() == 1)
+    {
+        return first;
+    }
+    cv::cvtColor(first, first_gray, cv::COLOR_BGR2GRAY);
+    return first_gray;
+}
+
+FrameStatus VideoFrameSource::read(size_t, FrameScratch &, FrameView &view)
+{
+    if (!capture.read(frame))
+    {
+        return FrameStatus::End;
+    }
+    if (frame.channels() == 1)
+    {
+        view.pixels = frame;
+    } else
+    {
+        cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+        view.pixels = gray;
+    }
+    return FrameStatus::Ok;
+}
+
+ShmRingSource::~ShmRingSource()
+{
+    close();
+}
+
+void ShmRingSource::close()
+{
+    if (header != nullptr)
+    {
+        munmap(header, mapped_size);
+        header = nullptr;
+        slots = nullptr;
+    }
+}
+
+bool ShmRingSource::open()
+{
+    int fd = shm_open(shm_name.c_str(), O_RDWR, 0);
+    struct stat shm_stat;
+    if (fd < 0 || fstat(fd, &shm_stat) != 0 || static_cast<size_t>(shm_stat.st_size) < sizeof(ShmRingHeader))
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        return false;
+    }
+    mapped_size = static_cast<size_t>(shm_stat.st_size);
+    void *mapping = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+    header = static_cast<ShmRingHeader *>(mapping);
+
+    const size_t header_size = (sizeof(ShmRingHeader) + 63) / 64 * 64;
+    slot_size = (static_cast<size_t>(header->width) * header->height * header->bytes_per_pixel + 63) / 64 * 64;
+    slots = reinterpret_cast<uchar *>(header) + header_size;
+    return std::memcmp(header->magic, magic, 8) == 0 && (header->bytes_per_pixel == 1 || header->bytes_per_pixel == 2) && header->slot_count > 0 &&
+           header_size + slot_size * header->slot_count <= mapped_size;
+}
+
+bool ShmRingSource::wait_for(size_t index) const
+{
+    while (header->write_count.load(std::memory_order_acquire) <= index)
+    {
+        if (header->finished.load(std::memory_order_acquire) != 0 && header->write_count.load(std::memory_order_acquire) <= index)
+        {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+cv::Mat ShmRingSource::slot(size_t index) const
+{
+    int type = (header->bytes_per_pixel == 2) ? CV_16UC1 : CV_8UC1;
+    return cv::Mat(static_cast<int>(header->height), static_cast<int>(header->width), type, slots + (index % header->slot_count) * slot_size);
+}
+
+cv::Mat ShmRingSource::first_frame()
+{
+    /* Frame 0 cannot be overwritten before the worker released it, so it can be copied at leisure */
+    return wait_for(0) ? slot(0).clone() : cv::Mat();
+}
+
+FrameStatus ShmRingSource::read(size_t index, FrameScratch &, FrameView &view)
+{
+    if (!wait_for(index))
+    {
+        return FrameStatus::End;
+    }
+    view.pixels = slot(index);
+    return FrameStatus::Ok;
+}
+
+void ShmRingSource::release(size_t index)
+{
+    header->read_count.store(index + 1, std::memory_order_release);
+}